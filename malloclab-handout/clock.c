@@ -267,12 +267,21 @@ static void callibrate(int verbose)
 
 static clock_t start_tick = 0;
 
+/*
+ * Calibrate once, up front: it takes at least NEVENT clock ticks, so a
+ * process that forks timing workers should do it before the fork
+ */
+void init_comp_counter()
+{
+    if (cyc_per_tick == 0.0)
+        callibrate(0);
+}
+
 void start_comp_counter() 
 {
     struct tms t;
 
-    if (cyc_per_tick == 0.0)
-        callibrate(0);
+    init_comp_counter();
     times(&t);
     start_tick = t.tms_utime;
     start_counter();
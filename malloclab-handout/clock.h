@@ -1,5 +1,8 @@
 /* Routines for using cycle counter */
 
+/* Read the cycle counter (x86 only) */
+void access_counter(unsigned *hi, unsigned *lo);
+
 /* Start the counter */
 void start_counter();
 
@@ -17,6 +20,9 @@ double mhz_full(int verbose, int sleeptime);
 
 /** Special counters that compensate for timer interrupt overhead */
 
+/* Measure the timer interrupt overhead now rather than on first use */
+void init_comp_counter();
+
 void start_comp_counter();
 
 double get_comp_counter();
@@ -30,6 +30,7 @@ void init_fsecs(void)
     set_fcyc_epsilon(0.01);
     set_fcyc_k(3);
     Mhz = mhz(verbose > 0);
+    init_comp_counter(); /* once here, not again in every -j worker */
 #elif USE_ITIMER
     if (verbose)
 	printf("Measuring performance with the interval timer.\n");
@@ -7,23 +7,34 @@
  * Copyright (c) 2004, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE             /* for sched_setaffinity */
 #include <assert.h>
 #include <errno.h>
 #include <float.h>
+#include <pthread.h>
+#include <sched.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 
 #include "mm.h"
+#include "mm_mt.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
 #include "config.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -34,6 +45,16 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Latency histograms (-H) are log-linear: each power of two is split
+   into 1 << HIST_SUB buckets, so a bucket is within 1/16 of its values */
+#define HIST_SUB      4
+#define HIST_NBUCKET  ((64 - HIST_SUB + 1) << HIST_SUB)
+#define RSS_SAMPLE    64 /* ops between resident set samples */
+
+/* Multithreaded mode (-m) */
+#define MT_HANDOFF    64 /* frees handed to the next thread at a time */
+#define MT_REPS        3 /* best of this many runs per configuration */
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
@@ -54,29 +75,26 @@
  * Remember that index (-1) is the null pointer.
  */
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload, as a node of a treap */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* payloads below this one */
+    struct range_t *right; /* payloads above this one */
+    unsigned int prio;     /* treap priority; no child has a higher one */
     int index;             /* same index as free; for debugging */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
-    int index;                        /* index for free() to use later */
-    size_t size;                      /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     char filename[MAXLINE];
-    int ignore_ranges;   /* don't check ranges (i.e. this is too big) */
+    int ignore_ranges;   /* weren't ranges checked? (unused) */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
+    void *map;           /* mapping ops lives in, for a binary trace */
+    size_t map_len;      /* length of that mapping */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
     int *block_rand_base;/* index into random_data, if debug is on */
@@ -92,6 +110,35 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* Latencies, in cycles, of one type of request (-H) */
+typedef struct {
+    unsigned long count;
+    uint64_t max;
+    unsigned long bucket[HIST_NBUCKET];
+} hist_t;
+
+/*
+ * One replaying thread in multithreaded mode. Each thread replays the
+ * whole trace into its own blocks array; the frees of odd block ids
+ * are handed to the next thread (the inbox is the only shared part),
+ * so that a share of the frees are made by a thread that did not
+ * allocate the block.
+ */
+typedef struct mt_thread {
+    trace_t *trace;
+    int tid;
+    char **blocks;              /* this thread's blocks... */
+    size_t *block_sizes;        /* ... and their sizes */
+    char *outbox[MT_HANDOFF];   /* frees not yet handed over */
+    int noutbox;
+    pthread_mutex_t lock;       /* protects the inbox */
+    char **inbox;               /* blocks handed over for freeing */
+    int ninbox, maxinbox;
+    struct mt_thread *next;     /* the thread frees are handed to */
+    pthread_barrier_t *start;
+    int nomem;                  /* ran out of heap */
+} mt_thread_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* set in read_trace */
@@ -105,6 +152,8 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double rss_peak; /* largest resident heap and mappings seen (bytes) */
+    double rss_final;/* resident heap and mappings at the end (bytes) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -133,6 +182,9 @@ static enum { DBG_NONE, DBG_CHEAP, DBG_EXPENSIVE } debug_mode = DBG_CHEAP;
 int verbose = 1;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 int onetime_flag = 0;
+static int mt_threads = 0; /* replay from up to this many threads (-m) */
+static int jobs = 0;       /* evaluate this many traces at once (-j) */
+static FILE *hist_file;    /* latencies and counters go here (-H) */
 
 /* by default, no timeouts */
 static int set_timeout = 0;
@@ -152,11 +204,13 @@ char autoresult[MAXLINE]; /* autoresult string */
  * Function prototypes
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size,
                      const trace_t *trace, int opnum, int index);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static void check_ranges(const trace_t *trace, int opnum,
+                         const range_t *ranges);
 
 /* These functions implement the debugging code */
 static void init_random_data(void);
@@ -176,8 +230,19 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_hist(trace_t *trace);
+
+/* Routines for the multithreaded mode */
+static void run_mt_tests(int num_tracefiles, const char *tracedir,
+                         char **tracefiles);
+
+/* Routine for the parallel mode */
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, stats_t *mm_stats,
+                               range_t *ranges, speed_t *speed_params);
+static double eval_mm_mt(trace_t *trace, int nthreads, int cached);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
@@ -235,12 +300,16 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].util = eval_mm_util(trace, i, &mm_stats[i]);
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
             mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+            if (hist_file != NULL)
+                eval_mm_hist(trace);
+            if (verbose > 1)
+                mm_printstats();
         }
 
         free_trace(trace);
@@ -250,6 +319,122 @@ static void run_tests(int num_tracefiles, const char *tracedir,
     }
 }
 
+/*
+ * run_tests_parallel - Run the tests of -j mode. Each trace is evaluated
+ *     by run_tests in a worker process of its own, so it has its own
+ *     memlib heap and allocator globals, and at most jobs workers run
+ *     at once. Worker slot k is pinned to the k-th CPU this process may
+ *     run on, so no two timed runs share a CPU; jobs is cut down to the
+ *     number of CPUs. A worker sends its stats_t and error count back
+ *     over a pipe. The timeout (-s) applies to each worker. When that
+ *     leaves a single job, the traces are run in this process instead,
+ *     exactly as without -j.
+ */
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, stats_t *mm_stats,
+                               range_t *ranges, speed_t *speed_params)
+{
+    cpu_set_t allowed, one;
+    int *cpus, *trace_of, *fd_of, fd[2];
+    pid_t *pid_of, pid;
+    int ncpus = 0, running = 0, next = 0, slot, cpu, status, nerrors;
+    trace_t *trace;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        unix_error("sched_getaffinity failed in run_tests_parallel");
+    if ((cpus = malloc(CPU_SETSIZE * sizeof(int))) == NULL)
+        unix_error("malloc failed in run_tests_parallel");
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &allowed))
+            cpus[ncpus++] = cpu;
+    if (jobs > ncpus) {
+        fprintf(stderr, "Only %d CPUs: evaluating %d traces at a time\n",
+                ncpus, ncpus);
+        jobs = ncpus;
+    }
+    if (jobs == 1) {
+        /* One at a time: workers would only add a fork per trace */
+        free(cpus);
+        run_tests(num_tracefiles, tracedir, tracefiles, mm_stats, ranges,
+                  speed_params);
+        return;
+    }
+    if ((pid_of = calloc(jobs, sizeof(pid_t))) == NULL ||
+        (trace_of = calloc(jobs, sizeof(int))) == NULL ||
+        (fd_of = calloc(jobs, sizeof(int))) == NULL)
+        unix_error("calloc failed in run_tests_parallel");
+
+    /* The driver's own timeout would fire outside any worker */
+    alarm(0);
+
+    while (next < num_tracefiles || running > 0) {
+        /* Start a worker in every free slot */
+        for (slot = 0; slot < jobs && next < num_tracefiles; slot++) {
+            if (pid_of[slot] != 0)
+                continue;
+            if (pipe(fd) < 0)
+                unix_error("pipe failed in run_tests_parallel");
+            if ((pid = fork()) < 0)
+                unix_error("fork failed in run_tests_parallel");
+            if (pid == 0) {
+                /* Report only this trace's errors */
+                errors = 0;
+                close(fd[0]);
+                CPU_ZERO(&one);
+                CPU_SET(cpus[slot], &one);
+                sched_setaffinity(0, sizeof(one), &one);
+                if (set_timeout > 0)
+                    alarm(set_timeout);
+                run_tests(1, tracedir, &tracefiles[next], &mm_stats[next],
+                          ranges, speed_params);
+                if (write(fd[1], &mm_stats[next], sizeof(stats_t)) !=
+                    sizeof(stats_t) ||
+                    write(fd[1], &errors, sizeof(int)) != sizeof(int))
+                    _exit(1);
+                _exit(0);
+            }
+            close(fd[1]);
+            pid_of[slot] = pid;
+            trace_of[slot] = next++;
+            fd_of[slot] = fd[0];
+            running++;
+        }
+
+        /* Collect whichever worker finishes first */
+        if ((pid = wait(&status)) < 0)
+            unix_error("wait failed in run_tests_parallel");
+        for (slot = 0; slot < jobs && pid_of[slot] != pid; slot++)
+            ;
+        if (slot == jobs)
+            continue;
+        if (read(fd_of[slot], &mm_stats[trace_of[slot]], sizeof(stats_t)) ==
+            sizeof(stats_t) &&
+            read(fd_of[slot], &nerrors, sizeof(int)) == sizeof(int)) {
+            errors += nerrors;
+        } else {
+            /* The worker died: report the trace as invalid */
+            trace = read_trace(&mm_stats[trace_of[slot]], tracedir,
+                               tracefiles[trace_of[slot]]);
+            strcpy(mm_stats[trace_of[slot]].filename, trace->filename);
+            mm_stats[trace_of[slot]].ops = trace->num_ops;
+            mm_stats[trace_of[slot]].valid = 0;
+            fprintf(stderr, "ERROR [trace %s]: worker died", trace->filename);
+            free_trace(trace);
+            if (WIFSIGNALED(status))
+                fprintf(stderr, " on signal %d", WTERMSIG(status));
+            fprintf(stderr, "\n");
+            errors++;
+        }
+        close(fd_of[slot]);
+        pid_of[slot] = 0;
+        running--;
+    }
+    free(cpus);
+    free(pid_of);
+    free(trace_of);
+    free(fd_of);
+}
+
 /**************
  * Main routine
  **************/
@@ -266,6 +451,8 @@ int main(int argc, char **argv)
     speed_t speed_params;      /* input parameters to the xx_speed routines */
 
     int run_libc = 0;     /* If set, run libc malloc (set by -l) */
+    int lazy = 0;         /* If set, mm malloc coalesces lazily (-L) */
+    int release = 0;      /* If set, mm malloc gives memory back (-R) */
     int autograder = 0;   /* if set then called by autograder (-A) */
 
     /* temporaries used to compute the performance index */
@@ -280,7 +467,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hVAlD")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:j:m:H:hVAlLRD")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -318,6 +505,15 @@ int main(int argc, char **argv)
             run_libc = 1;
             break;
 
+        case 'L': /* Lazy coalescing in mm malloc */
+            lazy = 1;
+            mm_setlazy(1);
+            break;
+        case 'R': /* mm malloc gives memory back to the system */
+            release = 1;
+            mm_setrelease(1);
+            break;
+
         case 'V': /* Increase verbosity level */
             verbose += 1;
             break;
@@ -338,6 +534,33 @@ int main(int argc, char **argv)
             set_timeout = atoi(optarg);
             break;
 
+        case 'H': /* Write per-request latencies to a CSV file */
+            if ((hist_file = fopen(optarg, "w")) == NULL)
+                unix_error("Could not open %s", optarg);
+            fprintf(hist_file, "trace,malloc,malloc_p50,malloc_p99,"
+                    "malloc_max,free,free_p50,free_p99,free_max,realloc,"
+                    "realloc_p50,realloc_p99,realloc_max,find_block_hops,"
+                    "coalesce_none,coalesce_next,coalesce_prev,"
+                    "coalesce_both,extend_heap\n");
+            fflush(hist_file);
+            break;
+
+        case 'j': /* Evaluate up to N traces at once */
+            jobs = atoi(optarg);
+            if (jobs < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+
+        case 'm': /* Multithreaded replay from up to N threads */
+            mt_threads = atoi(optarg);
+            if (mt_threads < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+
         case 'h': /* Print this message */
             usage();
             exit(0);
@@ -367,6 +590,16 @@ int main(int argc, char **argv)
         alarm(set_timeout);
     }
 
+    /*
+     * In multithreaded mode only report how mm_mt scales
+     */
+    if (mt_threads > 0) {
+        run_mt_tests(num_tracefiles, tracedir, tracefiles);
+        if (errors != 0)
+            printf("Terminated with %d errors\n", errors);
+        exit(errors != 0);
+    }
+
     /*
      * Optionally run and evaluate the libc malloc package
      */
@@ -413,8 +646,12 @@ int main(int argc, char **argv)
     if (mm_stats == NULL)
         unix_error("mm_stats calloc in main failed");
 
-    run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
-              ranges, &speed_params);
+    if (jobs > 0 && !onetime_flag)
+        run_tests_parallel(num_tracefiles, tracedir, tracefiles, mm_stats,
+                           ranges, &speed_params);
+    else
+        run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
+                  ranges, &speed_params);
 
 
     /* Display the mm results in a compact table */
@@ -427,7 +664,9 @@ int main(int argc, char **argv)
                 printf(" => incorrect.\n\n");
             }
         } else {
-            printf("\nResults for mm malloc:\n");
+            printf("\nResults for mm malloc%s%s:\n",
+                   lazy ? " (lazy coalescing)" : "",
+                   release ? " (releasing memory)" : "");
             printresults(num_tracefiles, mm_stats);
             printf("\n");
         }
@@ -546,16 +785,74 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps
+ * The following routines manipulate the range tree, which keeps
  * track of the extent of every allocated block payload. We use the
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
+ *
+ * The payloads in the tree never overlap, so ordering them by lo
+ * orders them by hi as well, and a search for a payload that overlaps
+ * [lo, hi] can go down one side of every node that doesn't. The tree
+ * is a treap: each node's priority is a hash of its lo, and a node
+ * never has a higher priority than its parent, which keeps the depth
+ * logarithmic on any trace. Every operation is then O(log n), cheap
+ * enough that all traces are checked.
  ****************************************************************/
 
+/* Treap priority of the payload at lo (Fibonacci hashing) */
+#define RANGE_PRIO(lo) \
+    ((unsigned int) (((uint64_t) (uintptr_t) (lo) * 0x9e3779b97f4a7c15ULL) >> 32))
+
+/*
+ * insert_range - Add range p to the tree rooted at root, rotating it
+ *     up past any parent of lower priority; return the new root
+ */
+static range_t *insert_range(range_t *root, range_t *p)
+{
+    range_t *child;
+
+    if (root == NULL)
+        return p;
+    if (p->lo < root->lo) {
+        child = root->left = insert_range(root->left, p);
+        if (child->prio > root->prio) {
+            root->left = child->right;
+            child->right = root;
+            return child;
+        }
+    } else {
+        child = root->right = insert_range(root->right, p);
+        if (child->prio > root->prio) {
+            root->right = child->left;
+            child->left = root;
+            return child;
+        }
+    }
+    return root;
+}
+
+/*
+ * join_ranges - Join two trees, all of whose ranges in a lie below
+ *     those in b; return the root of the result
+ */
+static range_t *join_ranges(range_t *a, range_t *b)
+{
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+    if (a->prio > b->prio) {
+        a->right = join_ranges(a->right, b);
+        return a;
+    }
+    b->left = join_ranges(a, b->left);
+    return b;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list.
+ *     we create a range struct for this block and add it to the range tree.
  */
 static int add_range(range_t **ranges, char *lo, int size,
                      const trace_t *trace, int opnum, int index)
@@ -572,24 +869,22 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or within
+       a mapping the allocator made for it */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        !mem_is_mapped(lo, hi)) {
         malloc_error(trace, opnum,
                      "Payload (%p:%p) lies outside heap (%p:%p)",
                      lo, hi, mem_heap_lo(), mem_heap_hi());
         return 0;
     }
 
-    /* If we can't afford the linear-time loop, we check less thoroughly and
-       just assume the overlap will be caught by writing random bits. */
-    if(trace->ignore_ranges || debug_mode == DBG_NONE) return 1;
-
+    if(debug_mode == DBG_NONE) return 1;
 
     /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
+    for (p = *ranges;  p != NULL;  p = (hi < p->lo) ? p->left : p->right) {
+        if (lo <= p->hi && hi >= p->lo) {
             malloc_error(trace, opnum,
                          "Payload (%p:%p) overlaps another payload (%p:%p)\n",
                          lo, hi, p->lo, p->hi);
@@ -599,15 +894,16 @@ static int add_range(range_t **ranges, char *lo, int size,
 
     /*
      * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
         unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
+    p->left = p->right = NULL;
+    p->prio = RANGE_PRIO(lo);
     p->index = index;
-    *ranges = p;
+    *ranges = insert_range(*ranges, p);
 
     return 1;
 }
@@ -620,13 +916,13 @@ static void remove_range(range_t **ranges, char *lo)
     range_t *p;
     range_t **prevpp = ranges;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
+    for (p = *ranges;  p != NULL; p = *prevpp) {
         if (p->lo == lo) {
-            *prevpp = p->next;
+            *prevpp = join_ranges(p->left, p->right);
             free(p);
             break;
         }
-        prevpp = &(p->next);
+        prevpp = (lo < p->lo) ? &(p->left) : &(p->right);
     }
 }
 
@@ -635,16 +931,27 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
-
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (*ranges == NULL)
+        return;
+    clear_ranges(&(*ranges)->left);
+    clear_ranges(&(*ranges)->right);
+    free(*ranges);
     *ranges = NULL;
 }
 
+/*
+ * check_ranges - check the data of every block in the range tree
+ */
+static void check_ranges(const trace_t *trace, int opnum,
+                         const range_t *ranges)
+{
+    if (ranges == NULL)
+        return;
+    check_ranges(trace, opnum, ranges->left);
+    check_index(trace, opnum, ranges->index);
+    check_ranges(trace, opnum, ranges->right);
+}
+
 /**********************************************
  * The following routines handle the random data used for
  * checking memory access.
@@ -717,7 +1024,10 @@ static void check_index(const trace_t *trace, int opnum, int index) {
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename)
 {
-    FILE *tracefile;
+    FILE *tracefile = NULL;
+    tracehdr_t hdr;
+    struct stat st;
+    int fd;
     trace_t *trace;
     char type[MAXLINE];
     int index, size;
@@ -734,13 +1044,63 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     /* Read the trace file header */
     strcpy(trace->filename, tracedir);
     strcat(trace->filename, filename);
-    if ((tracefile = fopen(trace->filename, "r")) == NULL) {
+    if ((fd = open(trace->filename, O_RDONLY)) < 0) {
         unix_error("Could not open %s in read_trace", trace->filename);
     }
-    fscanf(tracefile, "%d", &trace->weight);
-    fscanf(tracefile, "%d", &trace->num_ids);
-    fscanf(tracefile, "%d", &trace->num_ops);
-    fscanf(tracefile, "%d", &trace->ignore_ranges);
+    if (read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+        memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) == 0) {
+        /* A binary trace (see trace.h): its ops are used in place */
+        trace->weight = hdr.weight;
+        trace->num_ids = hdr.num_ids;
+        trace->num_ops = hdr.num_ops;
+        trace->ignore_ranges = hdr.ignore_ranges;
+        if (fstat(fd, &st) < 0)
+            unix_error("fstat failed in read_trace");
+        if (hdr.num_ops < 0 || hdr.num_ids < 0 ||
+            (size_t) st.st_size !=
+            sizeof(hdr) + (size_t) hdr.num_ops * sizeof(traceop_t))
+            app_error("%s: binary trace is truncated or corrupt",
+                      trace->filename);
+        trace->map_len = st.st_size;
+        if ((trace->map = mmap(NULL, trace->map_len, PROT_READ, MAP_PRIVATE,
+                               fd, 0)) == MAP_FAILED)
+            unix_error("mmap failed in read_trace");
+        trace->ops = (traceop_t *) ((char *) trace->map + sizeof(hdr));
+        close(fd);
+
+        /* Every op must name a known request and a block id in range */
+        for (op_index = 0; op_index < trace->num_ops; op_index++) {
+            index = trace->ops[op_index].index;
+            switch (trace->ops[op_index].type) {
+            case ALLOC:
+            case REALLOC:
+                if (index < 0 || index >= trace->num_ids)
+                    app_error("%s: op %d has id %d, not in [0, %d)",
+                              trace->filename, op_index, index,
+                              trace->num_ids);
+                break;
+            case FREE:
+                if (index < -1 || index >= trace->num_ids)
+                    app_error("%s: op %d frees id %d, not in [-1, %d)",
+                              trace->filename, op_index, index,
+                              trace->num_ids);
+                break;
+            default:
+                app_error("%s: op %d has bogus type %d",
+                          trace->filename, op_index,
+                          trace->ops[op_index].type);
+            }
+        }
+    } else {
+        trace->map = NULL;
+        if ((tracefile = fdopen(fd, "r")) == NULL)
+            unix_error("fdopen failed in read_trace");
+        rewind(tracefile);
+        fscanf(tracefile, "%d", &trace->weight);
+        fscanf(tracefile, "%d", &trace->num_ids);
+        fscanf(tracefile, "%d", &trace->num_ops);
+        fscanf(tracefile, "%d", &trace->ignore_ranges);
+    }
 
     if(trace->weight < 0 || trace->weight > 3) {
         app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
@@ -750,7 +1110,7 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     }
 
     /* We'll store each request line in the trace in this array */
-    if ((trace->ops =
+    if (tracefile != NULL && (trace->ops =
          (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
         unix_error("malloc 2 failed in read_trace");
 
@@ -773,7 +1133,7 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
+    while (tracefile != NULL && fscanf(tracefile, "%s", type) != EOF) {
         switch(type[0]) {
         case 'a':
             fscanf(tracefile, "%d %d", &index, &size);
@@ -801,9 +1161,11 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
         op_index++;
         if(op_index == trace->num_ops) break;
     }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
+    if (tracefile != NULL) {
+        fclose(tracefile);
+        assert(max_index == trace->num_ids - 1);
+        assert(trace->num_ops == op_index);
+    }
 
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
@@ -825,11 +1187,14 @@ static void reinit_trace(trace_t *trace)
 
 /*
  * free_trace - Free the trace record and the four arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated (or mapped) in read_trace().
  */
 static void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* free the four arrays... */
+        munmap(trace->map, trace->map_len);
+    else
+        free(trace->ops);
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace->block_rand_base);
@@ -853,7 +1218,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
     char *oldp;
     char *p;
 
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree */
     mem_reset_brk();
     clear_ranges(ranges);
     reinit_trace(trace);
@@ -870,17 +1235,11 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         size = trace->ops[i].size;
 
         if(debug_mode == DBG_EXPENSIVE) {
-            range_t *r;
-
             /* Let the students check their own heap */
             mm_checkheap(verbose);
 
             /* Now check that all our allocated blocks have the right data */
-            r = *ranges;
-            while(r) {
-                check_index(trace, i, r->index);
-                r = r->next;
-            }
+            check_ranges(trace, i, *ranges);
         }
 
         switch (trace->ops[i].type) {
@@ -895,7 +1254,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
 
             /*
              * Test the range of the new block for correctness and add it
-             * to the range list if OK. The block must be  be aligned properly,
+             * to the range tree if OK. The block must be  be aligned properly,
              * and must not overlap any currently allocated block.
              */
             if (add_range(ranges, p, size, trace, i, index) == 0)
@@ -926,10 +1285,10 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
             }
 
 
-            /* Remove the old region from the range list */
+            /* Remove the old region from the range tree */
             remove_range(ranges, oldp);
 
-            /* Check new block for correctness and add it to range list */
+            /* Check new block for correctness and add it to range tree */
             if (size > 0) {
                 if(add_range(ranges, newp, size, trace, i, index) == 0)
                     return 0;
@@ -952,7 +1311,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         case FREE: /* mm_free */
             check_index(trace, i, index);
 
-            /* Remove region from list and call student's free function */
+            /* Remove region from tree and call student's free function */
             if(index == -1) {
                 p = 0;
             } else {
@@ -976,28 +1335,35 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
- *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   Utilization is the ratio hwm/peak, where peak is the largest
+ *   footprint, heap plus mappings, the student's malloc package reached
+ *   on the trace. The heap can shrink (mem_trim) and mappings come and
+ *   go, so this is not the heap size at the end.
+ *
+ *   The resident set of the heap and mappings is sampled every
+ *   RSS_SAMPLE ops and at the end, into stats->rss_peak and
+ *   stats->rss_final.
  *
  *   A higher number is better: 1 is optimal.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats)
 {
     int i;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
+    double rss;
     char *p;
     char *newp, *oldp;
 
     reinit_trace(trace);
 
-    /* initialize the heap and the mm malloc package */
+    /* initialize the heap and the mm malloc package; the pages the
+       correctness run touched are dropped so they are not counted */
+    mem_release(mem_heap_lo(), mem_heapsize());
     mem_reset_brk();
+    stats->rss_peak = 0;
     if (mm_init() < 0)
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
 
@@ -1061,11 +1427,17 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         /* update the high-water mark */
         max_total_size = (total_size > max_total_size) ?
             total_size : max_total_size;
+
+        if (i % RSS_SAMPLE == 0 && (rss = mem_rss()) > stats->rss_peak)
+            stats->rss_peak = rss;
     }
 
+    stats->rss_final = mem_rss();
+    if (stats->rss_final > stats->rss_peak)
+        stats->rss_peak = stats->rss_final;
     printf(".");
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peaksize());
 }
 
 
@@ -1121,6 +1493,141 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * cycles - read the cycle counter
+ */
+static uint64_t cycles(void)
+{
+    unsigned hi, lo;
+
+    access_counter(&hi, &lo);
+    return ((uint64_t) hi << 32) | lo;
+}
+
+/*
+ * hist_add - count a latency of v cycles in histogram h
+ */
+static void hist_add(hist_t *h, uint64_t v)
+{
+    int e, b;
+
+    if (v < (1 << HIST_SUB)) {
+        b = v;
+    } else {
+        e = 63 - __builtin_clzll(v);     /* 2^e <= v < 2^(e+1) */
+        b = ((e - HIST_SUB + 1) << HIST_SUB) +
+            ((v >> (e - HIST_SUB)) & ((1 << HIST_SUB) - 1));
+    }
+    h->bucket[b]++;
+    h->count++;
+    if (v > h->max)
+        h->max = v;
+}
+
+/*
+ * hist_pct - the smallest latency in the bucket that holds the
+ *     fraction q of the requests of histogram h
+ */
+static uint64_t hist_pct(const hist_t *h, double q)
+{
+    unsigned long seen = 0, want = (unsigned long) (q * h->count);
+    int b, e;
+
+    if (h->count == 0)
+        return 0;
+    if (want >= h->count)
+        want = h->count - 1;
+    for (b = 0; seen + h->bucket[b] <= want; b++)
+        seen += h->bucket[b];
+    if (b < (1 << HIST_SUB))
+        return b;
+    e = (b >> HIST_SUB) + HIST_SUB - 1;
+    return (uint64_t) ((1 << HIST_SUB) | (b & ((1 << HIST_SUB) - 1)))
+        << (e - HIST_SUB);
+}
+
+/*
+ * eval_mm_hist - Replay the trace once more, timing every request with
+ *     the cycle counter, and write a row of the -H file: the count,
+ *     median, 99th percentile and maximum latency of each type of
+ *     request, and the hot-path counters of mm.c. The cost of reading
+ *     the counter is measured first and taken off every latency.
+ */
+static void eval_mm_hist(trace_t *trace)
+{
+    int i, index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    uint64_t t0, t1, ovhd = UINT64_MAX;
+    hist_t *hist;
+    mm_counters_t c;
+
+    if ((hist = calloc(3, sizeof(hist_t))) == NULL)
+        unix_error("calloc failed in eval_mm_hist");
+    for (i = 0; i < 1000; i++) {
+        t0 = cycles();
+        t1 = cycles();
+        if (t1 - t0 < ovhd)
+            ovhd = t1 - t0;
+    }
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_hist");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            size = trace->ops[i].size;
+            t0 = cycles();
+            p = mm_malloc(size);
+            t1 = cycles();
+            if (p == NULL)
+                app_error("mm_malloc error in eval_mm_hist");
+            trace->blocks[index] = p;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            newsize = trace->ops[i].size;
+            oldp = trace->blocks[index];
+            t0 = cycles();
+            newp = mm_realloc(oldp, newsize);
+            t1 = cycles();
+            if (newp == NULL && newsize != 0)
+                app_error("mm_realloc error in eval_mm_hist");
+            trace->blocks[index] = newp;
+            break;
+
+        case FREE: /* mm_free */
+            block = (index < 0) ? NULL : trace->blocks[index];
+            t0 = cycles();
+            mm_free(block);
+            t1 = cycles();
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_mm_hist");
+        }
+        hist_add(&hist[trace->ops[i].type],
+                 (t1 - t0 > ovhd && t1 > t0) ? t1 - t0 - ovhd : 0);
+    }
+
+    mm_getcounters(&c);
+    fprintf(hist_file, "%s", trace->filename);
+    for (i = ALLOC; i <= REALLOC; i++)
+        fprintf(hist_file, ",%lu,%llu,%llu,%llu", hist[i].count,
+                (unsigned long long) hist_pct(&hist[i], 0.50),
+                (unsigned long long) hist_pct(&hist[i], 0.99),
+                (unsigned long long) hist[i].max);
+    fprintf(hist_file, ",%lu,%lu,%lu,%lu,%lu,%lu\n", c.hops,
+            c.coalesce_none, c.coalesce_next, c.coalesce_prev,
+            c.coalesce_both, c.extend_heaps);
+    fflush(hist_file);
+    free(hist);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1218,6 +1725,284 @@ static void eval_libc_speed(void *ptr)
     }
 }
 
+/*************************************************************
+ * Multithreaded mode: the traces are replayed by 1, 2, 4, ...
+ * up to mt_threads threads at once, first with every request
+ * going through one lock (mt_init(0)) and then through the
+ * thread caches (mt_init(1)), and the throughputs compared.
+ ************************************************************/
+
+/*
+ * run_mt_tests - print the multithreaded throughput of each trace
+ */
+static void run_mt_tests(int num_tracefiles, const char *tracedir,
+                         char **tracefiles)
+{
+    int i, n, last;
+    double locked, cached, locked1 = 0, cached1 = 0;
+    stats_t stats;
+    trace_t *trace;
+
+    for (i = 0; i < num_tracefiles; i++) {
+        mem_init();
+        trace = read_trace(&stats, tracedir, tracefiles[i]);
+        printf("\n%s: %d ops per thread\n", trace->filename, trace->num_ops);
+        printf("%8s%12s%8s%12s%8s\n",
+               "threads", "lock Kops", "scale", "cache Kops", "scale");
+
+        for (n = 1, last = 0; !last; n *= 2) {
+            if (n >= mt_threads) {
+                n = mt_threads;
+                last = 1;
+            }
+            locked = eval_mm_mt(trace, n, 0);
+            cached = eval_mm_mt(trace, n, 1);
+            if (locked == 0 || cached == 0) {
+                printf("%8d%12s%8s%12s%8s\n", n, "-", "-", "-", "-");
+                break;
+            }
+            locked = n * trace->num_ops / 1e3 / locked;
+            cached = n * trace->num_ops / 1e3 / cached;
+            if (n == 1) {
+                locked1 = locked;
+                cached1 = cached;
+            }
+            printf("%8d%12.0f%7.2fx%12.0f%7.2fx\n", n,
+                   locked, locked / locked1, cached, cached / cached1);
+        }
+
+        free_trace(trace);
+        mem_deinit();
+    }
+}
+
+/*
+ * mt_check - check that the first and last byte of block index, as
+ *     written by mt_fill, are intact
+ */
+static int mt_check(mt_thread_t *t, int opnum, char *p, int index)
+{
+    size_t size = t->block_sizes[index];
+    char tag = (char)(index ^ t->tid);
+
+    if (p[0] != tag || p[size - 1] != tag) {
+        printf("ERROR [trace %s, line %d, thread %d]: block %d garbled\n",
+               t->trace->filename, LINENUM(opnum), t->tid, index);
+        __atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+static void mt_fill(mt_thread_t *t, char *p, int index)
+{
+    size_t size = t->block_sizes[index];
+
+    p[0] = p[size - 1] = (char)(index ^ t->tid);
+}
+
+/*
+ * mt_handoff - give this thread's outbox to the next thread
+ */
+static void mt_handoff(mt_thread_t *t)
+{
+    mt_thread_t *to = t->next;
+
+    pthread_mutex_lock(&to->lock);
+    if (to->ninbox + t->noutbox > to->maxinbox) {
+        to->maxinbox = 2 * (to->ninbox + t->noutbox);
+        to->inbox = realloc(to->inbox, to->maxinbox * sizeof(char *));
+        if (to->inbox == NULL)
+            unix_error("realloc failed in mt_handoff");
+    }
+    memcpy(to->inbox + to->ninbox, t->outbox, t->noutbox * sizeof(char *));
+    to->ninbox += t->noutbox;
+    pthread_mutex_unlock(&to->lock);
+    t->noutbox = 0;
+}
+
+/*
+ * mt_drain - free everything handed to this thread so far
+ */
+static void mt_drain(mt_thread_t *t)
+{
+    char *batch[MT_HANDOFF * 4];
+    int i, n;
+
+    do {
+        pthread_mutex_lock(&t->lock);
+        n = t->ninbox < MT_HANDOFF * 4 ? t->ninbox : MT_HANDOFF * 4;
+        t->ninbox -= n;
+        memcpy(batch, t->inbox + t->ninbox, n * sizeof(char *));
+        pthread_mutex_unlock(&t->lock);
+        for (i = 0; i < n; i++)
+            mt_free(batch[i]);
+    } while (n == MT_HANDOFF * 4);
+}
+
+/*
+ * mt_replay - thread routine: replay the trace through mm_mt
+ */
+static void *mt_replay(void *vargp)
+{
+    mt_thread_t *t = vargp;
+    trace_t *trace = t->trace;
+    int i, index;
+    size_t size;
+    char *p, *oldp;
+
+    pthread_barrier_wait(t->start);
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC:
+            if ((p = mt_malloc(size)) == NULL)
+                goto nomem;
+            t->blocks[index] = p;
+            t->block_sizes[index] = size;
+            mt_fill(t, p, index);
+            break;
+
+        case REALLOC:
+            oldp = t->blocks[index];
+            if (oldp != NULL && !mt_check(t, i, oldp, index))
+                goto done;
+            if ((p = mt_realloc(oldp, size)) == NULL && size != 0)
+                goto nomem;
+            /* The first byte must have been copied */
+            if (oldp != NULL && p != NULL) {
+                t->block_sizes[index] = 1;
+                if (!mt_check(t, i, p, index))
+                    goto done;
+            }
+            t->blocks[index] = p;
+            t->block_sizes[index] = size;
+            if (p != NULL)
+                mt_fill(t, p, index);
+            break;
+
+        case FREE:
+            if (index < 0) {
+                mt_free(NULL);
+                break;
+            }
+            p = t->blocks[index];
+            if (!mt_check(t, i, p, index))
+                goto done;
+            t->blocks[index] = NULL;
+            if (index % 2 == 0) {
+                mt_free(p);
+                break;
+            }
+            t->outbox[t->noutbox++] = p;
+            if (t->noutbox == MT_HANDOFF)
+                mt_handoff(t);
+            break;
+
+        default:
+            app_error("Nonexistent request type in mt_replay");
+        }
+
+        if (i % MT_HANDOFF == 0)
+            mt_drain(t);
+    }
+    goto done;
+
+ nomem:
+    /* Not an error: nthreads copies of the trace need not fit */
+    t->nomem = 1;
+ done:
+    if (t->noutbox > 0)
+        mt_handoff(t);
+    mt_drain(t);
+    mt_thread_exit();
+    return NULL;
+}
+
+/*
+ * eval_mm_mt - replay trace from nthreads threads at once, with or
+ *     without the thread caches, MT_REPS times. Returns the best wall
+ *     clock time in seconds, or 0 if there were errors or the heap
+ *     was too small for nthreads copies of the trace.
+ */
+static double eval_mm_mt(trace_t *trace, int nthreads, int cached)
+{
+    mt_thread_t *threads;
+    pthread_t *tids;
+    pthread_barrier_t start;
+    struct timespec t0, t1;
+    double secs, best = 0;
+    int i, j, rep, nomem = 0, nerrors = errors;
+
+    threads = calloc(nthreads, sizeof(mt_thread_t));
+    tids = calloc(nthreads, sizeof(pthread_t));
+    if (threads == NULL || tids == NULL)
+        unix_error("calloc failed in eval_mm_mt");
+
+    for (rep = 0; rep < MT_REPS && errors == nerrors && !nomem; rep++) {
+        /* Reset the heap and initialize the mm and mm_mt packages */
+        mem_reset_brk();
+        if (mm_init() < 0)
+            app_error("mm_init failed in eval_mm_mt");
+        mt_init(cached);
+
+        pthread_barrier_init(&start, NULL, nthreads + 1);
+        for (i = 0; i < nthreads; i++) {
+            mt_thread_t *t = &threads[i];
+
+            t->trace = trace;
+            t->tid = i;
+            t->blocks = calloc(trace->num_ids, sizeof(char *));
+            t->block_sizes = calloc(trace->num_ids, sizeof(size_t));
+            if (t->blocks == NULL || t->block_sizes == NULL)
+                unix_error("calloc failed in eval_mm_mt");
+            t->noutbox = t->ninbox = t->nomem = 0;
+            pthread_mutex_init(&t->lock, NULL);
+            t->next = &threads[(i + 1) % nthreads];
+            t->start = &start;
+        }
+        for (i = 0; i < nthreads; i++) {
+            if (pthread_create(&tids[i], NULL, mt_replay, &threads[i]) != 0)
+                unix_error("pthread_create failed in eval_mm_mt");
+        }
+
+        /* The threads may well be done before we return from the wait */
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        pthread_barrier_wait(&start);
+        for (i = 0; i < nthreads; i++)
+            pthread_join(tids[i], NULL);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        if (best == 0 || secs < best)
+            best = secs;
+
+        /* Frees handed to a thread after it finished, and blocks the
+           trace never freed */
+        for (i = 0; i < nthreads; i++) {
+            nomem |= threads[i].nomem;
+            mt_drain(&threads[i]);
+            for (j = 0; j < trace->num_ids; j++)
+                mt_free(threads[i].blocks[j]);
+            free(threads[i].blocks);
+            free(threads[i].block_sizes);
+            free(threads[i].inbox);
+            threads[i].inbox = NULL;
+            threads[i].maxinbox = 0;
+            pthread_mutex_destroy(&threads[i].lock);
+        }
+        mt_thread_exit();
+        pthread_barrier_destroy(&start);
+    }
+
+    free(threads);
+    free(tids);
+    return errors == nerrors && !nomem ? best : 0;
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
@@ -1239,8 +2024,8 @@ static void printresults(int n, stats_t *stats)
     char wstr;
 
     /* Print the individual results for each trace */
-    printf("  %2s%6s %5s%8s%9s  %s\n",
-           "valid", "util", "ops", "secs", "Kops", "trace");
+    printf("  %2s%6s%8s%8s %5s%8s%9s  %s\n",
+           "valid", "util", "pkRSS", "RSS", "ops", "secs", "Kops", "trace");
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
             switch(stats[i].weight)
@@ -1267,12 +2052,13 @@ static void printresults(int n, stats_t *stats)
             printf("%2c", wstr);
             printf("%4s", "yes");
 
-            /* print '--' if util isn't weighted */
+            /* print '--' if util isn't weighted; resident sets in KB */
             if(stats[i].weight == WNONE || stats[i].weight == WALL
                || stats[i].weight == WUTIL)
-                printf(" %5.0f%%", stats[i].util * 100.0);
+                printf(" %5.0f%%%7.0fK%7.0fK", stats[i].util * 100.0,
+                       stats[i].rss_peak / 1024, stats[i].rss_final / 1024);
             else
-                printf(" %6s", "--");
+                printf(" %6s%8s%8s", "--", "--", "--");
 
             /* print '--' if perf isn't weighted */
             if(stats[i].weight == WNONE || stats[i].weight == WALL
@@ -1297,13 +2083,15 @@ static void printresults(int n, stats_t *stats)
                 }
         }
         else {
-            printf("%2s%4s %6s%8s%10s%6s %s\n",
+            printf("%2s%4s %6s%8s%8s%8s%10s%6s %s\n",
                    stats[i].weight != 0 ? "*" : "",
                    "no",
                    "-",
                    "-",
                    "-",
                    "-",
+                   "-",
+                   "-",
                    stats[i].filename);
         }
     }
@@ -1313,16 +2101,17 @@ static void printresults(int n, stats_t *stats)
         if(sum_perf_weight == 0) sum_perf_weight = 1;
         if(sum_util_weight == 0) sum_util_weight = 1;
 
-        printf("%2d %2d  %5.0f%%%8.0f%10.6f%6.0f\n",
+        printf("%2d %2d  %5.0f%%%16s%8.0f%10.6f%6.0f\n",
                sum_util_weight,
                sum_perf_weight,
                (sumutil/(double)sum_util_weight)*100.0,
+               "",
                sumops,
                sumsecs,
                (sumsecs==0.0) ? 0 : (sumops/1e3)/sumsecs);
     }
     else {
-        printf("     %8s%10s%6s\n",
+        printf("     %24s%10s%6s\n",
                "-",
                "-",
                "-");
@@ -1383,8 +2172,13 @@ static void usage(void)
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Run mm malloc with lazy coalescing.\n");
+    fprintf(stderr, "\t-R         Run mm malloc giving free memory back to the system.\n");
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-H <file>  Write per-request latencies and allocator counters to CSV <file>.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to n traces at once, one process each.\n");
+    fprintf(stderr, "\t-m <n>     Replay each trace from 1 to n threads through mm_mt.\n");
 }
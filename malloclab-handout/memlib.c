@@ -3,6 +3,7 @@
  *						allows us to interleave calls from the student's malloc package
  *						with the system's malloc package in libc.
  */
+#define _GNU_SOURCE                 /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -17,10 +18,49 @@
 #include "memlib.h"
 #include "config.h"
 
+/* A region handed out by mem_map, remembered so that the driver can
+   tell its payloads apart from stray pointers */
+typedef struct mapping {
+	char *addr;
+	size_t len;
+	struct mapping *next;
+} mapping_t;
+
 /* private variables */
 static char *heap;
 static char *mem_brk;
 static char *mem_max_addr;
+static char *mem_brk_max;			/* highest brk since the last reset */
+static mapping_t *maps;				/* live mappings */
+static size_t mem_mapped;			/* bytes in them */
+static size_t mem_peak;				/* high water of heap plus mappings */
+static unsigned char mem_vec[MAX_HEAP / 4096 + 1];	/* for mincore */
+
+/*
+ * update_peak - record the current footprint if it is the largest yet
+ */
+static void update_peak(void) {
+	size_t size = (size_t)(mem_brk - heap) + mem_mapped;
+
+	if (size > mem_peak)
+		mem_peak = size;
+	if (mem_brk > mem_brk_max)
+		mem_brk_max = mem_brk;
+}
+
+/*
+ * unmap_all - drop every mapping still handed out
+ */
+static void unmap_all(void) {
+	mapping_t *m;
+
+	while ((m = maps) != NULL) {
+		maps = m->next;
+		munmap(m->addr, m->len);
+		free(m);
+	}
+	mem_mapped = 0;
+}
 
 /*
  * mem_init - initialize the memory system model
@@ -35,26 +75,32 @@ void mem_init(void){
 			0);						/* offset (dunno) */
 	mem_max_addr = heap + MAX_HEAP;
 	mem_brk = heap;					/* heap is empty initially */
+	mem_brk_max = heap;
+	mem_peak = 0;
 }
 
 /*
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void){
+	unmap_all();
 	munmap(heap, MAX_HEAP);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *		and drop the mappings of the previous run
  */
 void mem_reset_brk(){
+	unmap_all();
 	mem_brk = heap;
+	mem_peak = 0;
 }
 
 /*
  * mem_sbrk - simple model of the sbrk function. Extends the heap
  *		by incr bytes and returns the start address of the new area. In
- *		this model, the heap cannot be shrunk.
+ *		this model, the heap only shrinks through mem_trim.
  */
 void *mem_sbrk(int incr) {
 	char *old_brk = mem_brk;
@@ -68,9 +114,134 @@ void *mem_sbrk(int incr) {
 	}
 
 	mem_brk += incr;
+	update_peak();
 	return (void *)old_brk;
 }
 
+/*
+ * mem_trim - shrink the heap by decr bytes. The whole pages given up
+ *		are handed back to the system. Returns 0, or -1 if decr is
+ *		negative or larger than the heap.
+ */
+int mem_trim(int decr) {
+	if (decr < 0 || decr > mem_brk - heap) {
+		errno = EINVAL;
+		return -1;
+	}
+	mem_brk -= decr;
+	mem_release(mem_brk, (size_t)decr);
+	return 0;
+}
+
+/*
+ * mem_release - tell the system that the whole pages inside the len
+ *		bytes at p hold nothing of value. They stay mapped and read
+ *		back as zeros, but no longer count towards the resident set.
+ */
+void mem_release(void *p, size_t len) {
+	uintptr_t page = mem_pagesize();
+	uintptr_t lo = ((uintptr_t)p + page - 1) & ~(page - 1);
+	uintptr_t hi = ((uintptr_t)p + len) & ~(page - 1);
+
+	if (lo < hi)
+		madvise((void *)lo, hi - lo, MADV_DONTNEED);
+}
+
+/*
+ * mem_map - map len bytes of fresh memory outside the heap, for
+ *		objects too large to carve from it. len is rounded up to whole
+ *		pages by the caller. Returns NULL if there is no memory.
+ */
+void *mem_map(size_t len) {
+	mapping_t *m;
+	void *p;
+
+	if ((m = malloc(sizeof(mapping_t))) == NULL)
+		return NULL;
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		free(m);
+		errno = ENOMEM;
+		fprintf(stderr, "ERROR: mem_map failed. Ran out of memory...\n");
+		return NULL;
+	}
+	m->addr = p;
+	m->len = len;
+	m->next = maps;
+	maps = m;
+	mem_mapped += len;
+	update_peak();
+	return p;
+}
+
+/*
+ * find_map - the record of the mapping starting at p, or NULL
+ */
+static mapping_t **find_map(void *p) {
+	mapping_t **mp;
+
+	for (mp = &maps; *mp != NULL; mp = &(*mp)->next)
+		if ((*mp)->addr == p)
+			return mp;
+	return NULL;
+}
+
+/*
+ * mem_remap - resize the mapping at p to newlen bytes, moving it if
+ *		it cannot grow where it is. Returns its address, or NULL (and
+ *		the old mapping is left alone) if there is no memory.
+ */
+void *mem_remap(void *p, size_t newlen) {
+	mapping_t **mp = find_map(p);
+	void *q;
+
+	if (mp == NULL)
+		return NULL;
+	q = mremap(p, (*mp)->len, newlen, MREMAP_MAYMOVE);
+	if (q == MAP_FAILED) {
+		errno = ENOMEM;
+		fprintf(stderr, "ERROR: mem_remap failed. Ran out of memory...\n");
+		return NULL;
+	}
+	mem_mapped += newlen - (*mp)->len;
+	(*mp)->addr = q;
+	(*mp)->len = newlen;
+	update_peak();
+	return q;
+}
+
+/*
+ * mem_unmap - give the mapping at p back to the system. Returns 0, or
+ *		-1 if p is not a mapping from mem_map.
+ */
+int mem_unmap(void *p) {
+	mapping_t **mp = find_map(p), *m;
+
+	if (mp == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	m = *mp;
+	*mp = m->next;
+	munmap(m->addr, m->len);
+	mem_mapped -= m->len;
+	free(m);
+	return 0;
+}
+
+/*
+ * mem_is_mapped - whether bytes lo through hi lie within one mapping
+ */
+int mem_is_mapped(const void *lo, const void *hi) {
+	mapping_t *m;
+
+	for (m = maps; m != NULL; m = m->next)
+		if ((const char *)lo >= m->addr && (const char *)hi < m->addr + m->len)
+			return 1;
+	return 0;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -92,6 +263,44 @@ size_t mem_heapsize() {
 	return (size_t)((uintptr_t)mem_brk - (uintptr_t)heap);
 }
 
+/*
+ * mem_peaksize() - returns the largest footprint, heap plus mappings,
+ *		since the last reset
+ */
+size_t mem_peaksize() {
+	return mem_peak;
+}
+
+/*
+ * resident - bytes of the len bytes at p (page aligned) now in memory
+ */
+static size_t resident(char *p, size_t len) {
+	size_t page = mem_pagesize(), n = (len + page - 1) / page;
+	size_t chunk, i, res = 0;
+
+	for (; n > 0; p += chunk * page, n -= chunk) {
+		chunk = n < sizeof(mem_vec) ? n : sizeof(mem_vec);
+		if (mincore(p, chunk * page, mem_vec) < 0)
+			return 0;
+		for (i = 0; i < chunk; i++)
+			res += mem_vec[i] & 1;
+	}
+	return res * page;
+}
+
+/*
+ * mem_rss() - returns the bytes of heap and mappings now resident in
+ *		memory
+ */
+size_t mem_rss() {
+	mapping_t *m;
+	size_t rss = resident(heap, (size_t)(mem_brk_max - heap));
+
+	for (m = maps; m != NULL; m = m->next)
+		rss += resident(m->addr, m->len);
+	return rss;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
@@ -9,3 +9,15 @@ void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
 
+/* Giving memory back, and memory outside the heap */
+int mem_trim(int decr);
+void mem_release(void *p, size_t len);
+void *mem_map(size_t len);
+void *mem_remap(void *p, size_t newlen);
+int mem_unmap(void *p);
+int mem_is_mapped(const void *lo, const void *hi);
+
+/* Footprint: high water of heap plus mappings, and resident bytes */
+size_t mem_peaksize(void);
+size_t mem_rss(void);
+
@@ -7,10 +7,23 @@
  *
  * Header & Footer: Free blocks have header and footer. Both are
  * identical. Footer is used during coalescing.It indicates size
- * and allocation status of each block.
+ * and allocation status of each block. Allocated blocks have only a
+ * header: bit 1 of every header (GET_PREV_ALLOC) tells whether the
+ * previous block is allocated, so a footer is only needed when the
+ * block is free and a neighbour may coalesce with it.
+ *
+ * Free list links: the heap never exceeds MAX_HEAP, so a free block
+ * stores its next and previous links as 4-byte offsets from the start
+ * of the heap rather than as pointers. Header, two links and footer
+ * make the minimum block 16 bytes.
  *
  * Allocation: Free block is searched starting from minimum size list.
- * If block is not found then heap is extended.
+ * If block is not found then heap is extended. The extension starts at
+ * CHUNKSIZE and doubles, up to CHUNKMAX, each time the heap has to grow
+ * again within EXTEND_WINDOW mallocs; it halves back when growth is
+ * rare. Requests bigger than the chunk get exactly their size, and a
+ * free block at the end of the heap is counted against the growth.
+ * Every decision is counted in stats, which mm_printstats prints.
  *
  * Freeing of block: Block is freed on request by adding to appropriate
  * free list and doing coalescing (combining with other free blocks) to
@@ -18,9 +31,47 @@
  
  * Free list Implementation: It uses segregated list approach which
  * uses multiple Linked lists. Lists are used to store
- * different sized blocks. Each list has maximum size limit as
- * defined in LIST#MAX variables (where # is list number). Last list
- * includes all the maximum size blocks.
+ * different sized blocks. The list (size class) of a size is computed
+ * from its log2 and the next SUBBITS bits below the leading one, with
+ * a count-leading-zeros instruction. Last list includes all the
+ * maximum size blocks. A 64-bit map records which lists are non-empty,
+ * so the first list that can satisfy a request is found with one
+ * count-trailing-zeros instead of visiting every list.
+ *
+ * Lazy coalescing (mm_setlazy): freed blocks of up to QUICK_MAX bytes
+ * are not coalesced but pushed, still marked allocated, on a quick
+ * list of their exact size, from which malloc takes them back first.
+ * Only when find_fit fails are all quick lists swept: each block is
+ * then freed and coalesced for real, and the search is retried.
+ *
+ * Large blocks: the last class, TREE, is not a list but a splay tree
+ * keyed on block size, kept inside the free blocks themselves. Each
+ * tree node is the first free block of its size; other blocks of the
+ * same size hang off it in a list (NEXT_FREE/PREV_FREE), so the tree
+ * holds distinct sizes only. Lookups are best fit in O(log n)
+ * amortized, and a size seen recently is near the root.
+ *
+ * Large objects: requests of MMAP_MIN bytes or more are mapped outside
+ * the heap (mem_map), so a huge object that is freed goes straight back
+ * to the system instead of leaving the heap inflated for good. Realloc
+ * resizes such an object with mem_remap.
+ *
+ * Giving memory back (mm_setrelease): a free block at the end of the
+ * heap of trim_min bytes or more shrinks the heap (mem_trim); a large
+ * free block elsewhere has its pages released (mem_release). Pages
+ * given back cost a fault each when they are used again, so this is
+ * off unless asked for, and trim_min grows each time the heap has to
+ * grow back after a trim.
+ *
+ * Slab pages: requests of up to SLAB_MAX bytes never reach the lists.
+ * Each small size class, SLAB_STEP bytes apart, has pages of SLAB_PAGE
+ * bytes (each an ordinary allocated block) carved into equal slots,
+ * with a bitmap of the free ones. Malloc and free of a small object
+ * are a bit scan and a bit flip: no splitting, coalescing or footer.
+ * The word before a slab object holds its offset in the page with
+ * SLAB_BIT set, a bit that block headers never have, so free can tell
+ * the two apart. Pages with a free slot are kept on a list per class;
+ * a page is given back to the free lists when its last slot is freed.
  */
 #include <assert.h>
 #include <stdio.h>
@@ -36,8 +87,13 @@
 #define WSIZE       4       /* Word and header/footer size (bytes) */
 #define DSIZE       8       /* Double word size (bytes) */
 
-/* Extend heap by this amount (bytes) */
-#define CHUNKSIZE  (1<<8)  
+/* Extend heap by at least and at most this amount (bytes) */
+#define CHUNKSIZE  (1<<8)
+#define CHUNKMAX   (1<<12)
+/* Growing again within this many mallocs doubles the chunk */
+#define EXTEND_WINDOW 16
+/* ... but the chunk stays below 1/(1 << CHUNKFRAC) of the heap */
+#define CHUNKFRAC  6
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc))
@@ -61,20 +117,143 @@
 
 /* Given block ptr bp, compute address of next and prev free blocks */
 #define NEXT_FREE(bp)   ((char*) ((char*)(bp)))
-#define PREV_FREE(bp)   ((char*) ((char*)(bp) + DSIZE))
+#define PREV_FREE(bp)   ((char*) ((char*)(bp) + WSIZE))
+
+/* Given tree node bp, compute address of its left and right child */
+#define LEFT(bp)        ((char*)(bp) + 2*WSIZE)
+#define RIGHT(bp)       ((char*)(bp) + 3*WSIZE)
+
+/* Read and write a free list or tree link at address p. A link is the
+   block's offset from the start of the heap in one word; offset 0 is
+   the first list head, never a block, so it stands for NULL. */
+#define GET_LINK(p)     (GET(p) ? heap_listp + GET(p) : NULL)
+#define PUT_LINK(p, bp) PUT(p, (bp) == NULL ? 0 : \
+                            (unsigned int) ((char *)(bp) - heap_listp))
 
 /* Read and write double word at address p */
 #define GETDW(p)      (*(size_t *) (p))
 #define PUTDW(p, val) (*(size_t *) (p) = (val))
 
-/* Number of segregated lists */
+/* Smallest block: header, two links and footer */
+#define MINBLOCK    (2*DSIZE)
+
+/* Number of segregated lists (at most 64, one bit each in list_map) */
 #define LISTCT  13
+/* The last list is a size-keyed tree of all the largest blocks */
+#define TREE    (LISTCT - 1)
+/* Size classes per power of two are 1 << SUBBITS */
+#define SUBBITS 1
+/* Smallest block size is 16, whose log2 is 4 */
+#define MINLOG  4
+
+/* Address of the head pointer of list i */
+#define LIST(i) (heap_listp + (i)*DSIZE)
+
+/* Slab pages: SLABCT classes of SLAB_STEP bytes, for up to SLAB_MAX */
+#define SLAB_PAGE  4096
+#define SLAB_STEP  8
+#define SLABCT     4
+#define SLAB_MAX   ((SLABCT + 1)*SLAB_STEP - WSIZE)
+#define SLAB_BIT   0x4
+/* Below this heap size a page would be a large share of the heap */
+#define SLAB_MINHEAP (SLAB_PAGE << 5)
+
+/* Slab class of a request, the slot size of a class, and the slab
+   page of an object */
+#define SLAB_CLASS(size) ((size) <= 2*SLAB_STEP - WSIZE ? 0 : \
+                          ((size) + WSIZE - 1) / SLAB_STEP - 1)
+#define SLAB_STRIDE(cls) (((cls) + 2) * SLAB_STEP)
+#define SLAB_PAGEP(bp)   ((slab_t *) ((char *)(bp) - \
+                                      (GET(HDRP(bp)) & ~SLAB_BIT)))
+
+/* Offset of the first slot; makes every object 8-byte aligned */
+#define SLAB_HDR   (ALIGN(sizeof(slab_t)) + WSIZE)
+
+/* Address of the head pointer of the page list of slab class i */
+#define SLAB(i) (heap_listp + (LISTCT + (i))*DSIZE)
+
+/* Requests of at least MMAP_MIN bytes are mapped outside the heap.
+   The mapping starts with its length and, in the word before the
+   payload, MMAP_TAG: SLAB_BIT with the alloc bit, which neither block
+   headers nor slab tags have. */
+#define MMAP_MIN   (1<<17)
+#define MMAP_HDR   (2*DSIZE)
+#define MMAP_TAG   (SLAB_BIT | 1)
+#define IS_MMAP(bp)  (GET(HDRP(bp)) == MMAP_TAG)
+#define MMAP_LEN(bp) GETDW((char *)(bp) - MMAP_HDR)
+
+/* A free last block of at least trim_min bytes gives all but TRIM_KEEP
+   back. trim_min starts at TRIM_MIN and doubles whenever the heap has
+   to grow again after a trim. Other free blocks of at least RELEASE_MIN
+   bytes give back the pages inside them, once RELEASE_MIN bytes have
+   been freed since the last time: released pages that are soon reused
+   cost a fault each. */
+#define TRIM_MIN    (1<<22)
+#define TRIM_KEEP   (1<<16)
+#define RELEASE_MIN (1<<22)
+
+/* Lazy mode: QUICKCT quick lists, of exact block sizes 16 ... QUICK_MAX */
+#define QUICKCT    8
+#define QUICK_MAX  ((QUICKCT + 1)*DSIZE)
+#define QUICK(size) (heap_listp + (LISTCT + SLABCT + (size)/DSIZE - 2)*DSIZE)
+
+/* Number of list heads at the start of the heap */
+#define HEADCT     (LISTCT + SLABCT + (lazy ? QUICKCT : 0))
+
+/* A slab page, at the start of its block's payload */
+typedef struct slab {
+    struct slab *next;      /* next page with a free slot */
+    struct slab *prev;      /* previous page with a free slot */
+    uint64_t map[4];        /* bit s is set iff slot s is free */
+    unsigned int cls;       /* slab class of this page */
+    unsigned int nfree;     /* number of free slots */
+} slab_t;
 
 /* rounds up to the nearest multiple of 8 */
 #define ALIGN(p) (((size_t)(p) + 7) & ~0x7)
 
 static char *heap_listp; /* Pointer used to start lists on heap */
 static char *heap_start; /* Pointer used to point to the first block */
+static uint64_t list_map; /* Bit i is set iff list i is non-empty */
+static int lazy;          /* Defer coalescing (this heap) */
+static int lazy_next;     /* Set by mm_setlazy, for the next mm_init */
+static int release;       /* Give memory back to the system (this heap) */
+static int release_next;  /* Set by mm_setrelease, for the next mm_init */
+static size_t chunk;      /* Current heap extension size */
+static unsigned long last_extend; /* stats.mallocs at the last extension */
+static size_t unreleased; /* bytes freed since pages were last released */
+static size_t trim_min;   /* smallest free last block that is trimmed */
+static int trimmed;       /* the heap was trimmed since it last grew */
+
+/* Counters of the heap extension policy, reset by mm_init */
+static struct {
+    unsigned long mallocs;      /* calls to malloc */
+    unsigned long extends;      /* heap extensions by malloc */
+    unsigned long extend_bytes; /* bytes they added */
+    unsigned long exact;        /* extensions sized to the request */
+    unsigned long tail_reuse;   /* extensions cut short by a free tail */
+    unsigned long tail_bytes;   /* bytes of free tail reused that way */
+    unsigned long grow;         /* times the chunk was doubled */
+    unsigned long shrink;       /* times the chunk was halved */
+    unsigned long realloc_extends; /* heap extensions by realloc */
+    unsigned long quick_hits;   /* mallocs served from a quick list */
+    unsigned long sweeps;       /* quick list sweeps */
+    unsigned long swept;        /* blocks they coalesced */
+    unsigned long maps;         /* objects mapped outside the heap */
+    unsigned long remaps;       /* mapped objects resized */
+    unsigned long unmaps;       /* mapped objects unmapped */
+    unsigned long trims;        /* heap shrinks */
+    unsigned long trim_bytes;   /* bytes they gave back */
+    unsigned long releases;     /* free blocks whose pages were released */
+    unsigned long release_bytes; /* bytes in those blocks */
+    unsigned long hops;         /* free blocks find_block stepped past */
+    unsigned long coalesce_none; /* coalesces with no free neighbour */
+    unsigned long coalesce_next; /* ... with only the next one free */
+    unsigned long coalesce_prev; /* ... with only the previous one free */
+    unsigned long coalesce_both; /* ... with both free */
+    unsigned long extend_heaps; /* calls to extend_heap, mm_init's too */
+    size_t max_chunk;           /* largest chunk used */
+} stats;
 
 
 void *extend_heap(size_t words);
@@ -84,6 +263,14 @@ void place(void *bp, size_t asize);
 void addfree(char *bp, size_t asize);
 void delfree(char *bp, size_t asize);
 void *find_block(size_t listno, size_t asize);
+void *tree_fit(size_t asize);
+size_t size_class(size_t size);
+void *slab_malloc(size_t size);
+void slab_free(void *bp);
+static void free_block(void *ptr);
+static int sweep(void);
+static void *mmap_malloc(size_t size);
+static void give_back(char *bp);
 
 // Create aliases for driver tests
 // DO NOT CHANGE THE FOLLOWING!
@@ -128,24 +315,19 @@ int aligned(const void *p) {
  * returns -1 on error, 0 on success.
  */
 int mm_init(void) {
+    size_t listno;
+
+    lazy = lazy_next;
+    release = release_next;
+
     /* Create initial empty heap */
-    if ((heap_listp = mem_sbrk(LISTCT*DSIZE)) == NULL)
+    if ((heap_listp = mem_sbrk(HEADCT*DSIZE)) == NULL)
         return -1;
-    /* Segregations lists pointers 
+    /* Segregations lists, slab page lists and quick lists pointers
         initialization with null pointers*/
-    PUTDW(heap_listp , (size_t) NULL);
-    PUTDW(heap_listp + 8, (size_t) NULL);
-    PUTDW(heap_listp + 16, (size_t) NULL);
-    PUTDW(heap_listp + 24, (size_t) NULL);
-    PUTDW(heap_listp + 32, (size_t) NULL);
-    PUTDW(heap_listp + 40, (size_t) NULL);
-    PUTDW(heap_listp + 48, (size_t) NULL);
-    PUTDW(heap_listp + 56, (size_t) NULL);
-    PUTDW(heap_listp + 64, (size_t) NULL);
-    PUTDW(heap_listp + 72, (size_t) NULL);
-    PUTDW(heap_listp + 80, (size_t) NULL);
-    PUTDW(heap_listp + 88, (size_t) NULL);
-    PUTDW(heap_listp + 96, (size_t) NULL);
+    for (listno = 0; listno < HEADCT; listno++)
+        PUTDW(LIST(listno), (size_t) NULL);
+    list_map = 0;
     /* Extend heap for Epilogue & Prologue */
     if ((heap_start = mem_sbrk(4*WSIZE)) == NULL)
         return -1;
@@ -157,6 +339,13 @@ int mm_init(void) {
     /* Epilogue header */
     PUT(heap_start + (3*WSIZE), PACK(0, 3));
     
+    memset(&stats, 0, sizeof(stats));
+    chunk = stats.max_chunk = CHUNKSIZE;
+    last_extend = 0;
+    unreleased = 0;
+    trim_min = TRIM_MIN;
+    trimmed = 0;
+
     /* Puting CHUNKSIZE to heap */
     if (extend_heap(CHUNKSIZE) == NULL)
             return -1;
@@ -164,170 +353,239 @@ int mm_init(void) {
 }
 
 /*
- * Find_fit: Search for requested free block through all lists
+ * Size_class: Returns the list for blocks of the given size:
+ * (log2(size) - MINLOG) << SUBBITS, plus the SUBBITS bits that
+ * follow the leading one. Sizes past the last list go in the last.
+ */
+size_t size_class(size_t size) {
+    size_t lg = 63 - __builtin_clzl(size);
+    size_t listno = ((lg - MINLOG) << SUBBITS) +
+        ((size >> (lg - SUBBITS)) & ((1 << SUBBITS) - 1));
+
+    return listno < LISTCT ? listno : LISTCT - 1;
+}
+
+/*
+ * Find_fit: Search for requested free block. Its own size class is
+ * searched first fit, as it may also hold smaller blocks; after that
+ * the head of the first non-empty larger class always fits. Large
+ * requests, and small ones that only the tree can satisfy, get the
+ * best fit from the tree.
  */
  void *find_fit(size_t asize) {
-    size_t listno; 
-    char *bp = NULL; 
-    
-    /* Searching for first fit through all lists, starting with 
-        minimum size list*/
-    if (asize <= 24) {
-        for (listno = 0; listno < LISTCT; listno++) {
-            if ((bp = find_block(listno, asize)) != NULL)
-                return bp;
-        }
-    } else  if (asize <= 48) {
-        for (listno = 1; listno < LISTCT; listno++) {
-            if ((bp = find_block(listno, asize)) != NULL)
-                return bp;
-        }
-    } else  if (asize <= 72) {
-        for (listno = 2; listno < LISTCT; listno++) {
-            if ((bp = find_block(listno, asize)) != NULL)
-                return bp;
-        }
-    } else  if (asize <= 96) {
-        for (listno = 3; listno < LISTCT; listno++) {
-            if ((bp = find_block(listno, asize)) != NULL)
-                return bp;
-        }
-    } else  if (asize <= 120) {
-        for (listno = 4; listno < LISTCT; listno++) {
-            if ((bp = find_block(listno, asize)) != NULL)
-                return bp;
-        }
-    } else  if (asize <= 480) {
-        for (listno = 5; listno < LISTCT; listno++) {
-            if ((bp = find_block(listno, asize)) != NULL)
-                return bp;
-        }
-    } else  if (asize <= 960) {
-        for (listno = 6; listno < LISTCT; listno++) {
-            if ((bp = find_block(listno, asize)) != NULL)
-                return bp;
-        }
-    } else  if (asize <= 1920) {
-        for (listno = 7; listno < LISTCT; listno++) {
-            if ((bp = find_block(listno, asize)) != NULL)
-                return bp;
-        }
-    } else  if (asize <= 3840) {
-        for (listno = 8; listno < LISTCT; listno++) {
-            if ((bp = find_block(listno, asize)) != NULL)
-                return bp;
-        }
-    } else  if (asize <= 7680) {
-        for (listno = 9; listno < LISTCT; listno++) {
-            if ((bp = find_block(listno, asize)) != NULL)
-                return bp;
-        }
-    } else  if (asize <= 15360) {
-        for (listno = 10; listno < LISTCT; listno++) {
-            if ((bp = find_block(listno, asize)) != NULL)
-                return bp;
-        }
-    }else  if (asize <= 30720) {
-        for (listno = 11; listno < LISTCT; listno++) {
-            if ((bp = find_block(listno, asize)) != NULL)
-                return bp;
+    size_t listno = size_class(asize);
+    uint64_t larger;
+    char *bp;
+
+    if (listno == TREE)
+        return tree_fit(asize);
+    if ((bp = find_block(listno, asize)) != NULL)
+        return bp;
+    /* Mask off classes up to listno; the lowest bit left wins */
+    larger = list_map & ~((((uint64_t) 2) << listno) - 1);
+    if (larger == 0)
+        return NULL;
+    if ((listno = __builtin_ctzll(larger)) == TREE)
+        return tree_fit(asize);
+    return (char *) GETDW(LIST(listno));
+}
+
+
+/*
+ * Splay: Top-down splay of the tree rooted at t for key size. The node
+ * returned, the new root, is the one of that size if there is one, or
+ * else the last node on the search path: its predecessor or successor.
+ */
+static char *splay(char *t, size_t size) {
+    /* l and r are the largest node of the left tree built so far and
+       the smallest of the right tree; NULL while that tree is empty */
+    char *ltree = NULL, *rtree = NULL, *l = NULL, *r = NULL, *y;
+
+    while (1) {
+        if (size < GET_SIZE(HDRP(t))) {
+            if ((y = GET_LINK(LEFT(t))) == NULL)
+                break;
+            if (size < GET_SIZE(HDRP(y))) {
+                /* Rotate right */
+                PUT(LEFT(t), GET(RIGHT(y)));
+                PUT_LINK(RIGHT(y), t);
+                t = y;
+                if ((y = GET_LINK(LEFT(t))) == NULL)
+                    break;
+            }
+            /* Link right */
+            if (r == NULL)
+                rtree = t;
+            else
+                PUT_LINK(LEFT(r), t);
+            r = t;
+            t = y;
+        } else if (size > GET_SIZE(HDRP(t))) {
+            if ((y = GET_LINK(RIGHT(t))) == NULL)
+                break;
+            if (size > GET_SIZE(HDRP(y))) {
+                /* Rotate left */
+                PUT(RIGHT(t), GET(LEFT(y)));
+                PUT_LINK(LEFT(y), t);
+                t = y;
+                if ((y = GET_LINK(RIGHT(t))) == NULL)
+                    break;
+            }
+            /* Link left */
+            if (l == NULL)
+                ltree = t;
+            else
+                PUT_LINK(RIGHT(l), t);
+            l = t;
+            t = y;
+        } else {
+            break;
         }
-    } 
-    else {
-        listno = 12;
-        if ((bp = find_block(listno, asize)) != NULL)
-            return bp;
     }
-    return bp;
+    /* Assemble */
+    if (l == NULL)
+        ltree = GET_LINK(LEFT(t));
+    else
+        PUT(RIGHT(l), GET(LEFT(t)));
+    if (r == NULL)
+        rtree = GET_LINK(RIGHT(t));
+    else
+        PUT(LEFT(r), GET(RIGHT(t)));
+    PUT_LINK(LEFT(t), ltree);
+    PUT_LINK(RIGHT(t), rtree);
+    return t;
+}
+
+/*
+ * Tree_add: Adds free block bp of the given size to the tree, as a new
+ * node or, if its size is there already, behind that node
+ */
+static void tree_add(char *bp, size_t size) {
+    char *root = (char *) GETDW(LIST(TREE));
+
+    list_map |= ((uint64_t) 1) << TREE;
+    PUT_LINK(NEXT_FREE(bp), NULL);
+    PUT_LINK(PREV_FREE(bp), NULL);
+    if (root == NULL) {
+        PUT_LINK(LEFT(bp), NULL);
+        PUT_LINK(RIGHT(bp), NULL);
+    } else if (size == GET_SIZE(HDRP(root = splay(root, size)))) {
+        /* Same size: goes in the node's list and the root stays */
+        PUT(NEXT_FREE(bp), GET(NEXT_FREE(root)));
+        PUT_LINK(PREV_FREE(bp), root);
+        if (GET_LINK(NEXT_FREE(root)) != NULL)
+            PUT_LINK(PREV_FREE(GET_LINK(NEXT_FREE(root))), bp);
+        PUT_LINK(NEXT_FREE(root), bp);
+        bp = root;
+    } else if (size < GET_SIZE(HDRP(root))) {
+        PUT(LEFT(bp), GET(LEFT(root)));
+        PUT_LINK(RIGHT(bp), root);
+        PUT_LINK(LEFT(root), NULL);
+    } else {
+        PUT(RIGHT(bp), GET(RIGHT(root)));
+        PUT_LINK(LEFT(bp), root);
+        PUT_LINK(RIGHT(root), NULL);
+    }
+    PUTDW(LIST(TREE), (size_t) bp);
 }
 
+/*
+ * Tree_del: Removes free block bp of the given size from the tree.
+ * A block behind a node is just unlinked; a node with blocks behind
+ * it is replaced by the first of them.
+ */
+static void tree_del(char *bp, size_t size) {
+    char *root, *next = GET_LINK(NEXT_FREE(bp));
+
+    if (GET_LINK(PREV_FREE(bp)) != NULL) {
+        PUT_LINK(NEXT_FREE(GET_LINK(PREV_FREE(bp))), next);
+        if (next != NULL)
+            PUT(PREV_FREE(next), GET(PREV_FREE(bp)));
+        return;
+    }
+
+    /* bp is a node: bring it to the root */
+    splay((char *) GETDW(LIST(TREE)), size);
+    if (next != NULL) {
+        PUT_LINK(PREV_FREE(next), NULL);
+        PUT(LEFT(next), GET(LEFT(bp)));
+        PUT(RIGHT(next), GET(RIGHT(bp)));
+        root = next;
+    } else if (GET_LINK(LEFT(bp)) == NULL) {
+        root = GET_LINK(RIGHT(bp));
+    } else {
+        /* The largest node on the left has no right child */
+        root = splay(GET_LINK(LEFT(bp)), size);
+        PUT(RIGHT(root), GET(RIGHT(bp)));
+    }
+    PUTDW(LIST(TREE), (size_t) root);
+    if (root == NULL)
+        list_map &= ~(((uint64_t) 1) << TREE);
+}
+
+/*
+ * Tree_fit: Best fit from the tree: the smallest block of at least
+ * asize bytes, or NULL. An exact size is a splay and no more.
+ */
+ void *tree_fit(size_t asize) {
+    char *root = (char *) GETDW(LIST(TREE));
+    char *bp;
+
+    if (root == NULL)
+        return NULL;
+    root = splay(root, asize);
+    PUTDW(LIST(TREE), (size_t) root);
+    if (GET_SIZE(HDRP(root)) >= asize)
+        bp = root;
+    else if ((bp = GET_LINK(RIGHT(root))) == NULL)
+        return NULL;
+    else
+        while (GET_LINK(LEFT(bp)) != NULL)
+            bp = GET_LINK(LEFT(bp));
+    /* Prefer a block behind the node, which leaves the tree alone */
+    if (GET_LINK(NEXT_FREE(bp)) != NULL)
+        bp = GET_LINK(NEXT_FREE(bp));
+    return bp;
+}
 
 /*
  * Delfree: Deletes free block from the free list
  */
  void delfree(char *bp, size_t size) {
+    size_t listno = size_class(size);
+    char *next, *prev;
+
+    if (listno == TREE) {
+        tree_del(bp, size);
+        return;
+    }
+    next = GET_LINK(NEXT_FREE(bp));
+    prev = GET_LINK(PREV_FREE(bp));
+
     /* If free block to be removed is head of list */
-    if ((char *) GETDW(PREV_FREE(bp)) == NULL &&
-     (char *) GETDW(NEXT_FREE(bp)) != NULL) {
+    if (prev == NULL && next != NULL) {
         /* Update head of list */
-        if (size <= 24) {
-            PUTDW(heap_listp, (size_t) (char *) GETDW(NEXT_FREE(bp)));
-        } else if (size <= 48) {
-            PUTDW(heap_listp + 8, (size_t) (char *) GETDW(NEXT_FREE(bp)));
-        } else if (size <= 72) {
-            PUTDW(heap_listp + 16, (size_t) (char *) GETDW(NEXT_FREE(bp)));
-        } else if (size <= 96) {
-            PUTDW(heap_listp + 24, (size_t) (char *) GETDW(NEXT_FREE(bp)));
-        } else if (size <= 120) {
-            PUTDW(heap_listp + 32, (size_t) (char *) GETDW(NEXT_FREE(bp)));
-        } else if (size <= 480) {
-            PUTDW(heap_listp + 40, (size_t) (char *) GETDW(NEXT_FREE(bp)));
-        } else if (size <= 960) {
-            PUTDW(heap_listp + 48, (size_t) (char *) GETDW(NEXT_FREE(bp)));
-        } else if (size <= 1920) {
-            PUTDW(heap_listp + 56, (size_t) (char *) GETDW(NEXT_FREE(bp)));
-        } else if (size <= 3840) {
-            PUTDW(heap_listp + 64, (size_t) (char *) GETDW(NEXT_FREE(bp)));
-        } else if (size <= 7680) {
-            PUTDW(heap_listp + 72, (size_t) (char *) GETDW(NEXT_FREE(bp)));
-        } else if (size <= 15360) {
-            PUTDW(heap_listp + 80, (size_t) (char *) GETDW(NEXT_FREE(bp)));
-        }else if (size <= 30720) {
-            PUTDW(heap_listp + 88, (size_t) (char *) GETDW(NEXT_FREE(bp)));
-        }  
-        else {
-            PUTDW(heap_listp + 96, (size_t) (char *) GETDW(NEXT_FREE(bp)));
-        }
+        PUTDW(LIST(listno), (size_t) next);
         /* Previous block of new head will be NULL */
-        PUTDW(PREV_FREE((char *) GETDW(NEXT_FREE(bp))), (size_t) NULL);
+        PUT_LINK(PREV_FREE(next), NULL);
         
     /* If free block to be removed is only one in list */
-    } else if ((char *) GETDW(PREV_FREE(bp)) == NULL && 
-        (char *) GETDW(NEXT_FREE(bp)) == NULL) {
-        if (size <= 24) {
-            PUTDW(heap_listp , (size_t) NULL);
-        } else if (size <= 48) {
-            PUTDW(heap_listp + 8, (size_t) NULL);
-        } else if (size <= 72) {
-            PUTDW(heap_listp + 16, (size_t) NULL);
-        } else if (size <= 96) {
-            PUTDW(heap_listp + 24, (size_t) NULL);
-        } else if (size <= 120) {
-            PUTDW(heap_listp + 32, (size_t) NULL);
-        } else if (size <= 480) {
-            PUTDW(heap_listp + 40, (size_t) NULL);
-        } else if (size <= 960) {
-            PUTDW(heap_listp + 48, (size_t) NULL);
-        } else if (size <= 1920) {
-            PUTDW(heap_listp + 56, (size_t) NULL);
-        } else if (size <= 3840) {
-            PUTDW(heap_listp + 64, (size_t) NULL);
-        } else if (size <= 7680) {
-            PUTDW(heap_listp + 72, (size_t) NULL);
-        } else if (size <= 15360) {
-            PUTDW(heap_listp + 80, (size_t) NULL);
-        }else if (size <= 30720) {
-            PUTDW(heap_listp + 88, (size_t) NULL);
-        } 
-         else {
-            PUTDW(heap_listp + 96, (size_t) NULL);
-        }
+    } else if (prev == NULL && next == NULL) {
+        PUTDW(LIST(listno), (size_t) NULL);
+        list_map &= ~(((uint64_t) 1) << listno);
     
-    /* If free block to be removed is only one in list */
-    } else if ((char *) GETDW(PREV_FREE(bp)) != NULL &&
-     (char *) GETDW(NEXT_FREE(bp)) == NULL) {
+    /* If free block to be removed is last in list */
+    } else if (prev != NULL && next == NULL) {
         /* Update previous block's next pointer to NULL */
-        PUTDW(NEXT_FREE((char *) GETDW(PREV_FREE(bp))), (size_t) NULL);
+        PUT_LINK(NEXT_FREE(prev), NULL);
         
     /* If free block to be removed is in between 
         of two free blocks */
     } else {
         /* Update previous of next free block */
-        PUTDW(PREV_FREE((char *) GETDW(NEXT_FREE(bp))), 
-            (size_t) (char *) GETDW(PREV_FREE(bp)));
+        PUT_LINK(PREV_FREE(next), prev);
         /* Update next of previous free block */
-        PUTDW(NEXT_FREE((char *) GETDW(PREV_FREE(bp))), 
-            (size_t) (char *) GETDW(NEXT_FREE(bp)));
+        PUT_LINK(NEXT_FREE(prev), next);
     }
 }
 
@@ -347,10 +605,12 @@ int mm_init(void) {
     /* If prev & next both are allocated no need to combine,
         so return pointer to current block*/
     if (prev_alloc && next_alloc) {
+        stats.coalesce_none++;
         return bp;
         
     /* If prev is allocated & next is free */
     } else if (!prev_alloc && next_alloc) {
+        stats.coalesce_prev++;
     /* Remove both (current & next) free blocks from list */
         delfree(bp,size_current);
         delfree(PREV_BLKP(bp),GET_SIZE(HDRP(PREV_BLKP(bp))));
@@ -361,12 +621,15 @@ int mm_init(void) {
         PUT(HDRP(PREV_BLKP(bp)),PACK(size_current,
             GET_PREV_ALLOC(HDRP(PREV_BLKP(bp)))));
         PUT(FTRP(PREV_BLKP(bp)), GET(HDRP(PREV_BLKP(bp))));
-    /* add new free block to list */
-        addfree(PREV_BLKP(bp),size_current);
-        return PREV_BLKP(bp);
+    /* add new free block to list; its links may overwrite the
+        footer PREV_BLKP reads, so step back first */
+        bp = PREV_BLKP(bp);
+        addfree(bp,size_current);
+        return bp;
     
     /* If prev is free and next is allocated */
     } else if (prev_alloc && !next_alloc) {
+        stats.coalesce_next++;
         /* Remove both (current & next) free blocks from list */
         delfree(bp,size_current);
         delfree(NEXT_BLKP(bp),GET_SIZE(HDRP(NEXT_BLKP(bp))));
@@ -382,6 +645,7 @@ int mm_init(void) {
         
     /* If previous & next both are free */
     }  else {
+        stats.coalesce_both++;
         size_prev = GET_SIZE(HDRP(PREV_BLKP(bp)));
         size_next = GET_SIZE(HDRP(NEXT_BLKP(bp)));
     /* Remove all three (current, previous & next) 
@@ -396,9 +660,11 @@ int mm_init(void) {
         PUT(HDRP(PREV_BLKP(bp)),PACK(size_current,
             GET_PREV_ALLOC(HDRP(PREV_BLKP(bp)))));
         PUT(FTRP(PREV_BLKP(bp)), GET(HDRP(PREV_BLKP(bp))));
-    /* add new free block to list */
-        addfree(PREV_BLKP(bp),size_current);
-        return PREV_BLKP(bp);
+    /* add new free block to list; its links may overwrite the
+        footer PREV_BLKP reads, so step back first */
+        bp = PREV_BLKP(bp);
+        addfree(bp,size_current);
+        return bp;
     }
 }
 
@@ -415,6 +681,7 @@ int mm_init(void) {
     /* Extend heap by requested size */
     if ((long)(bp = mem_sbrk(words)) < 0)
         return NULL;
+    stats.extend_heaps++;
     /* Initialize the free block header */
     PUT(HDRP(bp),PACK(words,GET_PREV_ALLOC(HDRP(bp))));
     /* Initialize the free block footer */
@@ -431,69 +698,33 @@ int mm_init(void) {
  * then adds the block in front of list.
  */
  void addfree(char *bp, size_t size) {
-    char *head; /* Points to head of list */
-    char *start; /* Points to addres of head */
-    
-    /* Find appropriate list based on size */
-    if (size <= 24) {
-        start = heap_listp;
-        head = (char *) GETDW(heap_listp);
-    } else if (size <= 48) {
-        start = heap_listp + 8;
-        head = (char *) GETDW(heap_listp + 8);
-    } else if (size <= 72) {
-        start = heap_listp + 16;
-        head = (char *) GETDW(heap_listp + 16);
-    } else if (size <= 96) {
-        start = heap_listp + 24;
-        head = (char *) GETDW(heap_listp + 24);
-    } else if (size <= 120) {
-        start = heap_listp + 32;
-        head = (char *) GETDW(heap_listp + 32);
-    } else if (size <= 480) {
-        start = heap_listp + 40;
-        head = (char *) GETDW(heap_listp + 40);
-    } else if (size <= 960) {
-        start = heap_listp + 48;
-        head = (char *) GETDW(heap_listp + 48);
-    } else if (size <= 1920) {
-        start = heap_listp + 56;
-        head = (char *) GETDW(heap_listp + 56);
-    } else if (size <= 3840) {
-        start = heap_listp + 64;
-        head = (char *) GETDW(heap_listp + 64);
-    } else if (size <= 7680) {
-        start = heap_listp + 72;
-        head = (char *) GETDW(heap_listp + 72);
-    } else if (size <= 15360) {
-        start = heap_listp + 80;
-        head = (char *) GETDW(heap_listp + 80);
-    }else if (size <= 30720) {
-        start = heap_listp + 88;
-        head = (char *) GETDW(heap_listp + 88);
-    }  
-    else {
-        start = heap_listp + 96;
-        head = (char *) GETDW(heap_listp + 96);
+    size_t listno = size_class(size);
+    char *start = LIST(listno); /* Points to addres of head */
+    char *head = (char *) GETDW(start); /* Points to head of list */
+
+    if (listno == TREE) {
+        tree_add(bp, size);
+        return;
     }
+    list_map |= ((uint64_t) 1) << listno;
 
     /* If there are previous blocks in the list 
         then it is added to front*/
     if (head != NULL) {
         /* Current block will be set as head */
         PUTDW(start,(size_t) bp);
-        PUTDW(PREV_FREE(bp),(size_t) NULL);
-        PUTDW(NEXT_FREE(bp),(size_t) head);
+        PUT_LINK(PREV_FREE(bp), NULL);
+        PUT_LINK(NEXT_FREE(bp), head);
         /* Set previous block's previous pointer to current */
-        PUTDW(PREV_FREE(head),(size_t) bp);
+        PUT_LINK(PREV_FREE(head), bp);
         
     /* If there are no blocks in the list 
         then this is first free block */
     } else {
         /* Current block will be set as head */
         PUTDW(start,(size_t) bp);
-        PUTDW(NEXT_FREE(bp),(size_t) NULL);
-        PUTDW(PREV_FREE(bp),(size_t) NULL);
+        PUT_LINK(NEXT_FREE(bp), NULL);
+        PUT_LINK(PREV_FREE(bp), NULL);
     }
 }
 
@@ -502,54 +733,15 @@ int mm_init(void) {
  * Find_block: Search for requested free block in a list
  */
  void *find_block(size_t listno, size_t asize) {
-    char *bp = NULL;
-    switch (listno) {
-        case 0:
-            bp = (char *) GETDW(heap_listp);
-            break;
-        case 1:
-            bp = (char *) GETDW(heap_listp + 8);
-            break;
-        case 2:
-            bp = (char *) GETDW(heap_listp + 16);
-            break;
-        case 3:
-            bp = (char *) GETDW(heap_listp + 24);
-            break;
-        case 4:
-            bp = (char *) GETDW(heap_listp + 32);
-            break;
-        case 5:
-            bp = (char *) GETDW(heap_listp + 40);
-            break;
-        case 6:
-            bp = (char *) GETDW(heap_listp + 48);
-            break;
-        case 7:
-            bp = (char *) GETDW(heap_listp + 56);
-            break;
-        case 8:
-            bp = (char *) GETDW(heap_listp + 64);
-            break;
-        case 9:
-            bp = (char *) GETDW(heap_listp + 72);
-            break;
-        case 10:
-            bp = (char *) GETDW(heap_listp + 80);
-            break;
-        case 11:
-            bp = (char *) GETDW(heap_listp + 88);
-            break;
-        case 12:
-            bp = (char *) GETDW(heap_listp + 96);
-            break;
-    }
+    char *bp = (char *) GETDW(LIST(listno));
+
     /* Traverse through list to find the appropriate fit */
     while (bp != NULL) {
         if (asize <= GET_SIZE(HDRP(bp))) {
                 break; 
         }
-        bp = (char *) GETDW(NEXT_FREE(bp));
+        stats.hops++;
+        bp = GET_LINK(NEXT_FREE(bp));
     }
     return bp;
 }
@@ -567,8 +759,8 @@ int mm_init(void) {
     delfree(bp, size_current);
     
     /* Split block if remaining size is
-        greater than or equal to 24*/
-    if (size_r >= 3*DSIZE) {
+        at least the minimum block size */
+    if (size_r >= MINBLOCK) {
         PUT(HDRP(bp),PACK(asize,GET_PREV_ALLOC(HDRP(bp)) | 1));
         PUT(HDRP(NEXT_BLKP(bp)), size_r | 2);
         PUT(FTRP(NEXT_BLKP(bp)), size_r | 2);
@@ -585,6 +777,166 @@ int mm_init(void) {
 }
 
 
+/*
+ * Slab_unlink: Takes page sp off the page list of its class
+ */
+static void slab_unlink(slab_t *sp) {
+    if (sp->prev != NULL)
+        sp->prev->next = sp->next;
+    else
+        PUTDW(SLAB(sp->cls), (size_t) sp->next);
+    if (sp->next != NULL)
+        sp->next->prev = sp->prev;
+}
+
+/*
+ * Slab_malloc: Takes the first free slot of the first page with
+ * one of the size's class, starting a new page if there is none.
+ */
+void *slab_malloc(size_t size) {
+    size_t cls = SLAB_CLASS(size);
+    size_t stride = SLAB_STRIDE(cls);
+    slab_t *sp = (slab_t *) GETDW(SLAB(cls));
+    size_t slot, nslots, i;
+    char *bp;
+
+    if (sp == NULL) {
+        /* New page: an ordinary block, with every slot free */
+        if ((sp = malloc(SLAB_PAGE - WSIZE)) == NULL)
+            return NULL;
+        nslots = (SLAB_PAGE - WSIZE - SLAB_HDR) / stride;
+        for (i = 0; i < 4; i++) {
+            if (nslots >= 64*(i+1))
+                sp->map[i] = ~(uint64_t) 0;
+            else if (nslots > 64*i)
+                sp->map[i] = (((uint64_t) 1) << (nslots - 64*i)) - 1;
+            else
+                sp->map[i] = 0;
+        }
+        sp->cls = cls;
+        sp->nfree = nslots;
+        sp->prev = NULL;
+        sp->next = NULL;
+        PUTDW(SLAB(cls), (size_t) sp);
+    }
+
+    for (i = 0; sp->map[i] == 0; i++)
+        ;
+    slot = 64*i + __builtin_ctzll(sp->map[i]);
+    sp->map[i] &= sp->map[i] - 1;
+    if (--sp->nfree == 0)
+        slab_unlink(sp);
+
+    bp = (char *) sp + SLAB_HDR + slot*stride + WSIZE;
+    PUT(HDRP(bp), (unsigned int) (bp - (char *) sp) | SLAB_BIT);
+    return bp;
+}
+
+/*
+ * Slab_free: Marks the slot of bp free. A page that was full goes
+ * back on its list; a page that is now empty goes back to the heap.
+ */
+void slab_free(void *bp) {
+    slab_t *sp = SLAB_PAGEP(bp);
+    size_t stride = SLAB_STRIDE(sp->cls);
+    size_t slot = ((char *) bp - WSIZE - (char *) sp - SLAB_HDR) / stride;
+    size_t nslots = (SLAB_PAGE - WSIZE - SLAB_HDR) / stride;
+
+    sp->map[slot / 64] |= ((uint64_t) 1) << (slot % 64);
+    if (sp->nfree++ == 0) {
+        sp->prev = NULL;
+        sp->next = (slab_t *) GETDW(SLAB(sp->cls));
+        if (sp->next != NULL)
+            sp->next->prev = sp;
+        PUTDW(SLAB(sp->cls), (size_t) sp);
+    }
+    if (sp->nfree == nslots) {
+        slab_unlink(sp);
+        free(sp);
+    }
+}
+
+/*
+ * Extend_size: How far to extend the heap for a block of asize bytes
+ * that nothing fits, counting the decision in stats
+ */
+static size_t extend_size(size_t asize) {
+    char *epilogue = (char *) mem_heap_hi() + 1 - WSIZE;
+    size_t tail = 0, size;
+
+    /* Growing back what was trimmed: trim less eagerly */
+    if (trimmed) {
+        trimmed = 0;
+        trim_min <<= 1;
+    }
+
+    /* Growing often means a growing heap: take bigger steps */
+    if (last_extend != 0 && stats.mallocs - last_extend <= EXTEND_WINDOW) {
+        if (chunk < CHUNKMAX && chunk < mem_heapsize() >> CHUNKFRAC) {
+            chunk <<= 1;
+            stats.grow++;
+            if (chunk > stats.max_chunk)
+                stats.max_chunk = chunk;
+        }
+    } else if (chunk > CHUNKSIZE) {
+        chunk >>= 1;
+        stats.shrink++;
+    }
+    last_extend = stats.mallocs;
+
+    if (asize > chunk) {
+        size = asize;
+        stats.exact++;
+    } else {
+        size = chunk;
+    }
+    /* A free last block will be coalesced with the new space */
+    if (!GET_PREV_ALLOC(epilogue)) {
+        tail = GET_SIZE(epilogue - WSIZE);
+        size = size - tail < MINBLOCK ? MINBLOCK : size - tail;
+        stats.tail_reuse++;
+        stats.tail_bytes += tail;
+    }
+    stats.extends++;
+    stats.extend_bytes += size;
+    return size;
+}
+
+/*
+ * mm_printstats: Prints the heap extension counters since mm_init
+ */
+void mm_printstats(void) {
+    printf("mallocs %lu, extends %lu (%lu bytes, %lu exact, "
+           "%lu on a free tail of %lu bytes), realloc extends %lu, "
+           "chunk grown %lu shrunk %lu max %zu\n",
+           stats.mallocs, stats.extends, stats.extend_bytes, stats.exact,
+           stats.tail_reuse, stats.tail_bytes, stats.realloc_extends,
+           stats.grow, stats.shrink, stats.max_chunk);
+    if (lazy)
+        printf("quick list hits %lu, sweeps %lu of %lu blocks\n",
+               stats.quick_hits, stats.sweeps, stats.swept);
+    printf("mapped %lu, remapped %lu, unmapped %lu; trims %lu (%lu bytes, "
+           "threshold now %zu), released %lu blocks of %lu bytes\n",
+           stats.maps, stats.remaps, stats.unmaps, stats.trims,
+           stats.trim_bytes, trim_min, stats.releases, stats.release_bytes);
+    printf("find_block hops %lu; coalesces %lu alone, %lu with next, "
+           "%lu with prev, %lu with both; extend_heap calls %lu\n",
+           stats.hops, stats.coalesce_none, stats.coalesce_next,
+           stats.coalesce_prev, stats.coalesce_both, stats.extend_heaps);
+}
+
+/*
+ * mm_getcounters: Copies the hot-path counters since mm_init into c
+ */
+void mm_getcounters(mm_counters_t *c) {
+    c->hops = stats.hops;
+    c->coalesce_none = stats.coalesce_none;
+    c->coalesce_next = stats.coalesce_next;
+    c->coalesce_prev = stats.coalesce_prev;
+    c->coalesce_both = stats.coalesce_both;
+    c->extend_heaps = stats.extend_heaps;
+}
+
 /*
  * malloc: Allocated the block of requested size on heap and
  * returns pointer to the block.
@@ -596,9 +948,14 @@ void *malloc (size_t size) {
     
     if (size <= 0)
         return NULL;
+    stats.mallocs++;
+    if (size <= SLAB_MAX && mem_heapsize() >= SLAB_MINHEAP)
+        return slab_malloc(size);
+    if (size >= MMAP_MIN)
+        return mmap_malloc(size);
     /* Adjust block size to include alignment */
-    if (size <= 2*DSIZE)
-        asize = 3*DSIZE;
+    if (size <= MINBLOCK - WSIZE)
+        asize = MINBLOCK;
     else
         asize = (size_t)ALIGN(size + WSIZE);
     
@@ -607,16 +964,23 @@ void *malloc (size_t size) {
         mm_checkheap(0);
     #endif
     
-    /* Search the free list for a fit */
-    if ((bp = find_fit(asize)) != NULL) {
+    /* A block from the quick list of this size is ready to use */
+    if (lazy && asize <= QUICK_MAX &&
+        (bp = (char *) GETDW(QUICK(asize))) != NULL) {
+        PUTDW(QUICK(asize), GETDW(bp));
+        stats.quick_hits++;
+        return bp;
+    }
+
+    /* Search the free list for a fit, sweeping the quick lists
+       into it if there is none */
+    if ((bp = find_fit(asize)) != NULL ||
+        (lazy && sweep() && (bp = find_fit(asize)) != NULL)) {
         place(bp,asize); 
         return bp;
     }
     /* No fit found. Get more memory from heap and place it */
-    if (asize > CHUNKSIZE)
-        extendsize = asize;
-    else 
-        extendsize = CHUNKSIZE;
+    extendsize = extend_size(asize);
     if ((bp = extend_heap(extendsize)) == NULL)
         return NULL;
     place(bp,asize); 
@@ -630,7 +994,31 @@ void *malloc (size_t size) {
  */
 void free (void *ptr) {
     if(ptr == NULL) return;
+    if (IS_MMAP(ptr)) {
+        mem_unmap((char *) ptr - MMAP_HDR);
+        stats.unmaps++;
+        return;
+    }
+    if (GET(HDRP(ptr)) & SLAB_BIT) {
+        slab_free(ptr);
+        return;
+    }
+    /* Lazy mode: park small blocks on their quick list */
+    if (lazy && GET_SIZE(HDRP(ptr)) <= QUICK_MAX) {
+        PUTDW(ptr, GETDW(QUICK(GET_SIZE(HDRP(ptr)))));
+        PUTDW(QUICK(GET_SIZE(HDRP(ptr))), (size_t) ptr);
+        return;
+    }
+    free_block(ptr);
+}
+
+/*
+ * Free_block: Marks block ptr free, adds it to its list and
+ * coalesces it with its neighbours
+ */
+static void free_block(void *ptr) {
     size_t size = GET_SIZE(HDRP(ptr));
+    unreleased += size;
     /* Update header and footer to unallocated */
     PUT(HDRP(ptr), size | GET_PREV_ALLOC(HDRP(ptr)));
     PUT(FTRP(ptr), GET(HDRP(ptr)));
@@ -639,15 +1027,132 @@ void free (void *ptr) {
         (GET_SIZE(HDRP(NEXT_BLKP(ptr))) | GET_ALLOC(HDRP(NEXT_BLKP(ptr)))));
     /* Add free block to list */
     addfree(ptr,size);
-    coalesce(ptr);
+    give_back(coalesce(ptr));
+}
+
+/*
+ * Give_back: Returns the memory of free block bp to the system if it
+ * is large: a last block shrinks the heap to leave one chunk of it,
+ * any other has the whole pages inside it released.
+ */
+static void give_back(char *bp) {
+    size_t size = GET_SIZE(HDRP(bp)), keep;
+
+    if (!release)
+        return;
+    if (size >= trim_min && GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0) {
+        /* Give back whole pages' worth, keeping at least TRIM_KEEP */
+        keep = size - ((size - TRIM_KEEP) & ~(mem_pagesize() - 1));
+        delfree(bp, size);
+        PUT(HDRP(bp), PACK(keep, GET_PREV_ALLOC(HDRP(bp))));
+        PUT(FTRP(bp), GET(HDRP(bp)));
+        addfree(bp, keep);
+        mem_trim(size - keep);
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));
+        stats.trims++;
+        stats.trim_bytes += size - keep;
+        trimmed = 1;
+        return;
+    }
+    if (size < RELEASE_MIN || unreleased < RELEASE_MIN)
+        return;
+    /* Keep the links, tree children and footer */
+    mem_release(bp + 2*DSIZE, size - 3*DSIZE);
+    unreleased = 0;
+    stats.releases++;
+    stats.release_bytes += size;
+}
+
+/*
+ * Mmap_malloc: Maps an object of size bytes outside the heap
+ */
+static void *mmap_malloc(size_t size) {
+    size_t page = mem_pagesize();
+    size_t len = (size + MMAP_HDR + page - 1) & ~(page - 1);
+    char *p;
+
+    if ((p = mem_map(len)) == NULL)
+        return NULL;
+    PUTDW(p, len);
+    PUT(p + MMAP_HDR - WSIZE, MMAP_TAG);
+    stats.maps++;
+    return p + MMAP_HDR;
+}
+
+/*
+ * Sweep: Frees and coalesces every block on the quick lists.
+ * Returns the number of blocks swept.
+ */
+static int sweep(void) {
+    size_t size;
+    char *bp, *next;
+    int n = 0;
+
+    for (size = MINBLOCK; size <= QUICK_MAX; size += DSIZE) {
+        for (bp = (char *) GETDW(QUICK(size)); bp != NULL; bp = next) {
+            next = (char *) GETDW(bp);
+            free_block(bp);
+            n++;
+        }
+        PUTDW(QUICK(size), (size_t) NULL);
+    }
+    stats.sweeps++;
+    stats.swept += n;
+    return n;
+}
+
+/*
+ * mm_setlazy: Turns lazy coalescing on or off from the next mm_init
+ */
+void mm_setlazy(int on) {
+    lazy_next = on;
 }
 
 /*
- * realloc: It reallocates previous block with new size.
- * The old data is copied to new location and old block is freed.
+ * mm_setrelease: Turns giving memory back to the system on or off from
+ * the next mm_init
+ */
+void mm_setrelease(int on) {
+    release_next = on;
+}
+
+/*
+ * Fit: Makes allocated block bp, which spans size bytes, asize bytes
+ * long; the rest is split off as a free block if it is big enough.
+ */
+static void fit(void *bp, size_t size, size_t asize) {
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    char *next;
+
+    if (size - asize >= MINBLOCK) {
+        PUT(HDRP(bp), PACK(asize, prev_alloc | 1));
+        next = NEXT_BLKP(bp);
+        PUT(HDRP(next), PACK(size - asize, 2));
+        PUT(FTRP(next), GET(HDRP(next)));
+        addfree(next, size - asize);
+        next = NEXT_BLKP(next);
+        PUT(HDRP(next), GET(HDRP(next)) & ~0x2);
+        if (!GET_ALLOC(HDRP(next)))
+            PUT(FTRP(next), GET(HDRP(next)));
+        coalesce(PREV_BLKP(next));
+    } else {
+        PUT(HDRP(bp), PACK(size, prev_alloc | 1));
+        next = NEXT_BLKP(bp);
+        PUT(HDRP(next), GET(HDRP(next)) | 0x2);
+        if (!GET_ALLOC(HDRP(next)))
+            PUT(FTRP(next), GET(HDRP(next)));
+    }
+}
+
+/*
+ * realloc: Resizes the block in place when it can: a shrinking block
+ * splits off its tail, a growing one absorbs a free successor, and the
+ * last block of the heap grows the heap by just what it is missing.
+ * Only when none of that works is the data copied to a new block.
  */
 void *realloc(void *oldptr, size_t size) {
-    size_t oldsize;
+    size_t oldsize, asize, avail, need;
+    char *next;
     void *newptr;
 
     /* If size is 0 then this is free so return NULL. */
@@ -659,7 +1164,71 @@ void *realloc(void *oldptr, size_t size) {
     if(oldptr == NULL) {
         return malloc(size);
     }
-      
+
+    if (IS_MMAP(oldptr)) {
+        /* A mapped object that stays large is remapped, which moves
+           no data the system can avoid moving */
+        oldsize = MMAP_LEN(oldptr) - MMAP_HDR;
+        if (size >= MMAP_MIN) {
+            need = (size + MMAP_HDR + mem_pagesize() - 1) &
+                ~(mem_pagesize() - 1);
+            if (need == MMAP_LEN(oldptr))
+                return oldptr;
+            if ((next = mem_remap((char *) oldptr - MMAP_HDR, need)) == NULL)
+                return 0;
+            PUTDW(next, need);
+            stats.remaps++;
+            return next + MMAP_HDR;
+        }
+    } else if (GET(HDRP(oldptr)) & SLAB_BIT) {
+        /* A slab object stays in its slot if it still fits */
+        oldsize = SLAB_STRIDE(SLAB_PAGEP(oldptr)->cls) - WSIZE;
+        if (size <= oldsize)
+            return oldptr;
+    } else {
+        oldsize = GET_SIZE(HDRP(oldptr));
+        if (size <= MINBLOCK - WSIZE)
+            asize = MINBLOCK;
+        else
+            asize = (size_t)ALIGN(size + WSIZE);
+
+        /* Shrink in place */
+        if (asize <= oldsize) {
+            fit(oldptr, oldsize, asize);
+            return oldptr;
+        }
+
+        /* Bytes available without moving: this block and a free
+           successor, plus the heap's growth if that is the last block */
+        next = NEXT_BLKP(oldptr);
+        avail = oldsize;
+        if (!GET_ALLOC(HDRP(next))) {
+            avail += GET_SIZE(HDRP(next));
+            if (avail < asize && GET_SIZE(HDRP(NEXT_BLKP(next))) == 0) {
+                need = asize - avail < MINBLOCK ? MINBLOCK : asize - avail;
+                if (extend_heap(need) != NULL) {
+                    avail += need;
+                    stats.realloc_extends++;
+                }
+            }
+        } else if (GET_SIZE(HDRP(next)) == 0) {
+            need = asize - avail < MINBLOCK ? MINBLOCK : asize - avail;
+            if (extend_heap(need) != NULL) {
+                avail += need;
+                stats.realloc_extends++;
+            }
+        }
+
+        /* Grow in place */
+        if (avail >= asize) {
+            next = NEXT_BLKP(oldptr);
+            delfree(next, GET_SIZE(HDRP(next)));
+            fit(oldptr, avail, asize);
+            return oldptr;
+        }
+        oldsize -= WSIZE;
+    }
+
     /* Else allocate new space */
       newptr = malloc(size);
 
@@ -669,7 +1238,6 @@ void *realloc(void *oldptr, size_t size) {
       }
 
     /* Copy the old data. */
-      oldsize = GET_SIZE(HDRP(oldptr)) - WSIZE;
       if(size < oldsize) oldsize = size;
       memcpy(newptr, oldptr, oldsize);
 
@@ -690,6 +1258,31 @@ void *calloc (size_t nmemb, size_t size) {
     return ptr;
 }
 
+/*
+ * Check_tree: Checks the subtree at t, whose sizes must lie strictly
+ * between lo and hi
+ */
+static void check_tree(char *t, size_t lo, size_t hi) {
+    size_t size;
+    char *bp;
+
+    if (t == NULL)
+        return;
+    size = GET_SIZE(HDRP(t));
+    if (size <= lo || size >= hi || size_class(size) != TREE)
+        printf("Tree node %p of size %zu out of place\n", t, size);
+    if (GET_LINK(PREV_FREE(t)) != NULL)
+        printf("Tree node %p has a previous block\n", t);
+    for (bp = GET_LINK(NEXT_FREE(t)); bp != NULL;
+         bp = GET_LINK(NEXT_FREE(bp))) {
+        if (GET_SIZE(HDRP(bp)) != size)
+            printf("Block %p behind tree node %p has size %d\n",
+                   bp, t, GET_SIZE(HDRP(bp)));
+    }
+    check_tree(GET_LINK(LEFT(t)), lo, size);
+    check_tree(GET_LINK(RIGHT(t)), size, hi);
+}
+
 /*
  * mm_checkheap: Check the consistency of heap
  * 1. Check Prologue header
@@ -700,9 +1293,71 @@ void *calloc (size_t nmemb, size_t size) {
  * 6. Check inconsistency in next & previous pointers
  * 7. Check coalesce function
  * 8. Check Epilogue header
+ * 9. Check that the prev-alloc bit of every header, the epilogue's
+ *    included, matches the block before it (allocated blocks have
+ *    no footer to fall back on)
+ * 10. Check that each list holds only its size class and that
+ *    list_map marks exactly the non-empty lists
+ * 11. Check that each slab page list holds pages of its class with
+ *    free slots, and that each page's bitmap counts nfree slots
+ * 12. Check that the tree is ordered by size, holds only its class,
+ *    and that the blocks behind each node have the node's size
+ * 13. Check that each quick list holds blocks of its size, still
+ *    marked allocated
  */
 int mm_checkheap(int verbose) {
      char *bp;
+     size_t listno, i, nfree;
+     slab_t *sp;
+     unsigned int prev_alloc = 2; /* the prologue is allocated */
+
+    /* Checking lists against their size classes and list_map */
+    for (listno = 0; listno < LISTCT; listno++) {
+        bp = (char *) GETDW(LIST(listno));
+        if ((bp != NULL) != ((list_map >> listno) & 1))
+            printf("List map bit %zu does not match list\n", listno);
+        if (listno == TREE) {
+            check_tree(bp, 0, (size_t) -1);
+            continue;
+        }
+        for (; bp != NULL; bp = GET_LINK(NEXT_FREE(bp))) {
+            if (size_class(GET_SIZE(HDRP(bp))) != listno)
+                printf("Free block %p of size %d in list %zu\n",
+                       bp, GET_SIZE(HDRP(bp)), listno);
+        }
+    }
+
+    /* Checking slab pages */
+    for (listno = 0; listno < SLABCT; listno++) {
+        for (sp = (slab_t *) GETDW(SLAB(listno)); sp != NULL; sp = sp->next) {
+            if (!in_heap(sp) || !GET_ALLOC(HDRP(sp)))
+                printf("Slab page %p is not an allocated block\n",
+                       (void *) sp);
+            if (sp->cls != listno || sp->nfree == 0)
+                printf("Slab page %p of class %u with %u free slots "
+                       "in list %zu\n", (void *) sp, sp->cls, sp->nfree, listno);
+            if (sp->next != NULL && sp->next->prev != sp)
+                printf("Next pointer inconsistent for slab page %p\n",
+                       (void *) sp);
+            for (i = 0, nfree = 0; i < 4; i++)
+                nfree += __builtin_popcountll(sp->map[i]);
+            if (nfree != sp->nfree)
+                printf("Slab page %p bitmap has %zu free slots, not %u\n",
+                       (void *) sp, nfree, sp->nfree);
+        }
+    }
+
+    /* Checking quick lists */
+    for (i = MINBLOCK; lazy && i <= QUICK_MAX; i += DSIZE) {
+        for (bp = (char *) GETDW(QUICK(i)); bp != NULL;
+             bp = (char *) GETDW(bp)) {
+            if (!in_heap(bp) || GET_SIZE(HDRP(bp)) != i ||
+                !GET_ALLOC(HDRP(bp)))
+                printf("Block %p on quick list %zu has header %x\n",
+                       bp, i, GET(HDRP(bp)));
+        }
+    }
+
     /* Checking Prologue header */
     bp = heap_start + (1*WSIZE);
     if ((GET_SIZE(bp) != DSIZE) || !GET_ALLOC(bp))
@@ -712,7 +1367,7 @@ int mm_checkheap(int verbose) {
     bp = heap_start + (2*WSIZE);
     if ((GET_SIZE(bp) != DSIZE) || !GET_ALLOC(bp))
         printf("Invalid prologue footer\n");
-    bp = heap_listp + LISTCT*DSIZE + 2*DSIZE;
+    bp = heap_listp + HEADCT*DSIZE + 2*DSIZE;
     while ((GET(HDRP(bp)) != 1) && (GET(HDRP(bp)) != 3)) {
         if (verbose) {
             printf("Block pointer [%p] with size [%d],",bp, GET_SIZE(HDRP(bp)));
@@ -721,6 +1376,10 @@ int mm_checkheap(int verbose) {
             else
                 printf("It is allocated\n");
         }
+    /* Checking the previous block's allocation bit */
+        if (GET_PREV_ALLOC(HDRP(bp)) != prev_alloc)
+            printf("Wrong prev-alloc bit in block %p\n", bp);
+        prev_alloc = GET_ALLOC(HDRP(bp)) << 1;
     /* Checking alignment of each block */
         if (!aligned(bp))
             printf("Block with pointer %p is not aligned\n", bp);
@@ -734,11 +1393,14 @@ int mm_checkheap(int verbose) {
         if ((GET(HDRP(bp)) != GET(FTRP(bp))))
             printf("Header footer mismatch for block with pointer %p\n", bp);
     /* Checking inconsistencies in next & previous pointers */
-        if ((char *) GETDW(NEXT_FREE(bp)) != NULL &&
-        (char *) GETDW(PREV_FREE(GETDW(NEXT_FREE(bp)))) != bp)
+        if (!in_heap(heap_listp + GET(NEXT_FREE(bp))) ||
+            !in_heap(heap_listp + GET(PREV_FREE(bp))))
+            printf("Link out of heap in free block %p\n", bp);
+        else if (GET_LINK(NEXT_FREE(bp)) != NULL &&
+        GET_LINK(PREV_FREE(GET_LINK(NEXT_FREE(bp)))) != bp)
             printf("Next pointer inconsistent for free block %p\n", bp);
-        if ((char *) GETDW(PREV_FREE(bp)) != NULL && 
-        (char *) GETDW(NEXT_FREE(GETDW(PREV_FREE(bp)))) != bp)
+        else if (GET_LINK(PREV_FREE(bp)) != NULL && 
+        GET_LINK(NEXT_FREE(GET_LINK(PREV_FREE(bp)))) != bp)
             printf("Previous pointer inconsistent for free block %p\n", bp);
     /* Checking coalesce function */
         if ((GET(HDRP(NEXT_BLKP(bp))) != 1) && 
@@ -751,5 +1413,7 @@ int mm_checkheap(int verbose) {
     /* Checking Epilogue header */
     if (!((GET(HDRP(bp)) == 1) || (GET(HDRP(bp)) == 3)))
         printf("Invalid Epilogue header\n");
+    else if (GET_PREV_ALLOC(HDRP(bp)) != prev_alloc)
+        printf("Wrong prev-alloc bit in epilogue\n");
     return 0;
 }
\ No newline at end of file
@@ -23,3 +23,24 @@ extern int mm_init(void);
 /* This is largely for debugging.  You can do what you want with the
    verbose flag; we don't care. */
 extern int mm_checkheap(int verbose);
+
+/* Prints the allocator's counters since the last mm_init */
+extern void mm_printstats(void);
+
+/* Hot-path counters since the last mm_init, for mdriver -H */
+typedef struct {
+    unsigned long hops;          /* free blocks find_block stepped past */
+    unsigned long coalesce_none; /* coalesces with no free neighbour */
+    unsigned long coalesce_next; /* ... with only the next block free */
+    unsigned long coalesce_prev; /* ... with only the previous block free */
+    unsigned long coalesce_both; /* ... with both free */
+    unsigned long extend_heaps;  /* calls to extend_heap */
+} mm_counters_t;
+extern void mm_getcounters(mm_counters_t *c);
+
+/* Turns lazy coalescing on (1) or off (0), from the next mm_init */
+extern void mm_setlazy(int on);
+
+/* Turns trimming the heap and releasing the pages of large free blocks
+   on (1) or off (0), from the next mm_init */
+extern void mm_setrelease(int on);
@@ -0,0 +1,366 @@
+/*
+ * mm_mt.c - thread-caching front end to the mm.c allocator.
+ *
+ * mm.c keeps its heap in unsynchronized globals, so it is used here as
+ * an engine behind a single lock (engine_lock), and most requests never
+ * take that lock:
+ *
+ * Thread caches: every thread owns a tcache_t holding one singly linked
+ * list (bin) of free objects per small size class, MT_GRAIN bytes
+ * apart up to MT_MAXSMALL. Small mallocs and frees by the owning thread
+ * are a push or a pop on its own bin, with no locking at all.
+ *
+ * Central lists: one list per size class, each with its own lock. An
+ * empty bin takes MT_BATCH objects from its central list, and only when
+ * that is empty too does it carve MT_BATCH new objects out of mm.c under
+ * the engine lock. A bin that grows past 2*MT_BATCH gives MT_BATCH back.
+ *
+ * Remote frees: a small object freed by a thread other than its owner
+ * is pushed onto the owner's remote stack with a compare-and-swap. The
+ * owner takes the whole stack with one atomic exchange the next time
+ * one of its bins runs dry, so cross-thread frees never wait on a lock.
+ *
+ * Object layout: every object starts with an 8-byte tag just before the
+ * payload. For a small object the tag is its owner's tcache_t pointer
+ * (64-byte aligned) or'ed with its class; for a large one it is the
+ * payload size shifted left by 6 with MT_LARGE in the low bits. Large
+ * objects go straight to mm.c. While an object is free its first word
+ * links it into a bin, a central list or a remote stack.
+ *
+ * A thread that exits hands its cache to mt_thread_exit, which returns
+ * the bins to the central lists and parks the tcache_t on an idle list
+ * for the next new thread; frees still addressed to it are picked up by
+ * that thread.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mm.h"
+#include "mm_mt.h"
+
+/* The engine entry points (mm.c renames them for the driver) */
+#ifndef DRIVER
+#define mm_malloc malloc
+#define mm_free free
+#define mm_realloc realloc
+#endif
+
+#define TAGSIZE   8
+#define TAGBITS   0x3f     /* low bits of a tag; tcache_t is 64-aligned */
+#define MT_LARGE  TAGBITS  /* tag class of an object that skips the caches */
+
+/* Read the tag of payload p, and the next link of a free object */
+#define TAG(p)   (*(uintptr_t *)((char *)(p) - TAGSIZE))
+#define NEXT(p)  (*(void **)(p))
+
+typedef struct tcache {
+    void *bins[MT_NCLASS];  /* free objects owned by this thread */
+    int count[MT_NCLASS];   /* length of each bin */
+    void *remote;           /* objects freed by other threads */
+    unsigned int gen;       /* generation of mt_init it belongs to */
+    struct tcache *next;    /* next cache on the idle list */
+} __attribute__((aligned(64))) tcache_t;
+
+static struct {
+    pthread_mutex_t lock;
+    void *list;
+} central[MT_NCLASS];
+
+static pthread_mutex_t engine_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static tcache_t *idle;      /* caches of threads that have exited */
+static unsigned int generation;
+static int use_cache;
+
+static __thread tcache_t *mine;
+
+/*
+ * Mt_init: Forget every cache and central list. The heap they lived
+ * in is gone after mm_init, so nothing is handed back to mm.c.
+ */
+void mt_init(int cached) {
+    int cls;
+
+    for (cls = 0; cls < MT_NCLASS; cls++) {
+        pthread_mutex_init(&central[cls].lock, NULL);
+        central[cls].list = NULL;
+    }
+    idle = NULL;
+    generation++;
+    use_cache = cached;
+}
+
+/*
+ * Engine_malloc, engine_free: mm.c under the engine lock
+ */
+static void *engine_malloc(size_t size) {
+    void *p;
+
+    pthread_mutex_lock(&engine_lock);
+    p = mm_malloc(size);
+    pthread_mutex_unlock(&engine_lock);
+    return p;
+}
+
+static void engine_free(void *p) {
+    pthread_mutex_lock(&engine_lock);
+    mm_free(p);
+    pthread_mutex_unlock(&engine_lock);
+}
+
+/*
+ * My_cache: Returns the calling thread's cache, adopting an idle one
+ * or making a new one on first use. NULL if out of memory.
+ */
+static tcache_t *my_cache(void) {
+    char *p;
+
+    if (mine != NULL && mine->gen == generation)
+        return mine;
+    pthread_mutex_lock(&idle_lock);
+    if ((mine = idle) != NULL)
+        idle = mine->next;
+    pthread_mutex_unlock(&idle_lock);
+    if (mine != NULL)
+        return mine;
+
+    /* Caches are never freed, so over-allocate to align it */
+    if ((p = engine_malloc(sizeof(tcache_t) + 64)) == NULL)
+        return NULL;
+    mine = (tcache_t *) (((uintptr_t) p + 63) & ~(uintptr_t) 63);
+    memset(mine, 0, sizeof(tcache_t));
+    mine->gen = generation;
+    return mine;
+}
+
+/*
+ * Flush: Gives the first n objects of bin cls back to its central list
+ */
+static void flush(tcache_t *tc, int cls, int n) {
+    void *first = tc->bins[cls], *last = first;
+    int i;
+
+    if (n == 0)
+        return;
+    for (i = 1; i < n; i++)
+        last = NEXT(last);
+    tc->bins[cls] = NEXT(last);
+    tc->count[cls] -= n;
+
+    pthread_mutex_lock(&central[cls].lock);
+    NEXT(last) = central[cls].list;
+    central[cls].list = first;
+    pthread_mutex_unlock(&central[cls].lock);
+}
+
+/*
+ * Drain_remote: Moves everything other threads freed into the bins
+ */
+static void drain_remote(tcache_t *tc) {
+    void *p, *next;
+    int cls;
+
+    p = __atomic_exchange_n(&tc->remote, NULL, __ATOMIC_ACQUIRE);
+    for (; p != NULL; p = next) {
+        next = NEXT(p);
+        cls = TAG(p) & TAGBITS;
+        NEXT(p) = tc->bins[cls];
+        tc->bins[cls] = p;
+        tc->count[cls]++;
+    }
+}
+
+/*
+ * Refill: Fills the empty bin cls with up to MT_BATCH objects from the
+ * central list, or else from mm.c
+ */
+static void refill(tcache_t *tc, int cls) {
+    uintptr_t tag = (uintptr_t) tc | cls;
+    void *p, *list = NULL;
+    int n = 0;
+    char *bp;
+
+    pthread_mutex_lock(&central[cls].lock);
+    while (n < MT_BATCH && (p = central[cls].list) != NULL) {
+        central[cls].list = NEXT(p);
+        NEXT(p) = list;
+        list = p;
+        n++;
+    }
+    pthread_mutex_unlock(&central[cls].lock);
+
+    if (n == 0) {
+        pthread_mutex_lock(&engine_lock);
+        for (; n < MT_BATCH; n++) {
+            if ((bp = mm_malloc(TAGSIZE + (cls + 1) * MT_GRAIN)) == NULL)
+                break;
+            p = bp + TAGSIZE;
+            NEXT(p) = list;
+            list = p;
+        }
+        pthread_mutex_unlock(&engine_lock);
+    }
+
+    /* The objects are this thread's now */
+    for (p = list; p != NULL; p = NEXT(p))
+        TAG(p) = tag;
+    tc->bins[cls] = list;
+    tc->count[cls] = n;
+}
+
+/*
+ * mt_malloc: Small requests come from the thread's own bin; large
+ * ones from mm.c
+ */
+void *mt_malloc(size_t size) {
+    tcache_t *tc;
+    char *bp;
+    void *p;
+    int cls;
+
+    if (!use_cache)
+        return engine_malloc(size);
+    if (size == 0)
+        return NULL;
+    if (size > MT_MAXSMALL || (tc = my_cache()) == NULL) {
+        if ((bp = engine_malloc(TAGSIZE + size)) == NULL)
+            return NULL;
+        TAG(bp + TAGSIZE) = (size << 6) | MT_LARGE;
+        return bp + TAGSIZE;
+    }
+
+    cls = (size - 1) / MT_GRAIN;
+    if (tc->bins[cls] == NULL) {
+        drain_remote(tc);
+        if (tc->bins[cls] == NULL)
+            refill(tc, cls);
+        if (tc->bins[cls] == NULL)
+            return NULL;
+    }
+    p = tc->bins[cls];
+    tc->bins[cls] = NEXT(p);
+    tc->count[cls]--;
+    return p;
+}
+
+/*
+ * mt_free: The owner puts the object back in its bin; anyone else
+ * pushes it on the owner's remote stack
+ */
+void mt_free(void *ptr) {
+    tcache_t *owner, *tc;
+    uintptr_t tag;
+    int cls;
+
+    if (ptr == NULL)
+        return;
+    if (!use_cache) {
+        engine_free(ptr);
+        return;
+    }
+    tag = TAG(ptr);
+    cls = tag & TAGBITS;
+    if (cls == MT_LARGE) {
+        engine_free((char *) ptr - TAGSIZE);
+        return;
+    }
+
+    owner = (tcache_t *) (tag & ~(uintptr_t) TAGBITS);
+    if ((tc = my_cache()) == owner) {
+        NEXT(ptr) = tc->bins[cls];
+        tc->bins[cls] = ptr;
+        if (++tc->count[cls] > 2*MT_BATCH)
+            flush(tc, cls, MT_BATCH);
+        return;
+    }
+
+    NEXT(ptr) = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&owner->remote, &NEXT(ptr), ptr, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+}
+
+/*
+ * mt_realloc: A small object that stays in its class, or shrinks by
+ * less than one class, is returned as is; a large one that stays large
+ * is reallocated by mm.c; anything else is moved
+ */
+void *mt_realloc(void *ptr, size_t size) {
+    size_t oldsize;
+    uintptr_t tag;
+    char *bp;
+    void *newptr;
+
+    if (!use_cache) {
+        pthread_mutex_lock(&engine_lock);
+        newptr = mm_realloc(ptr, size);
+        pthread_mutex_unlock(&engine_lock);
+        return newptr;
+    }
+    if (size == 0) {
+        mt_free(ptr);
+        return NULL;
+    }
+    if (ptr == NULL)
+        return mt_malloc(size);
+
+    tag = TAG(ptr);
+    if ((tag & TAGBITS) != MT_LARGE) {
+        oldsize = ((tag & TAGBITS) + 1) * MT_GRAIN;
+        if (size <= oldsize && size > oldsize - MT_GRAIN)
+            return ptr;
+    } else {
+        oldsize = tag >> 6;
+        if (size > MT_MAXSMALL) {
+            pthread_mutex_lock(&engine_lock);
+            bp = mm_realloc((char *) ptr - TAGSIZE, TAGSIZE + size);
+            pthread_mutex_unlock(&engine_lock);
+            if (bp == NULL)
+                return NULL;
+            TAG(bp + TAGSIZE) = (size << 6) | MT_LARGE;
+            return bp + TAGSIZE;
+        }
+    }
+
+    if ((newptr = mt_malloc(size)) == NULL)
+        return NULL;
+    memcpy(newptr, ptr, size < oldsize ? size : oldsize);
+    mt_free(ptr);
+    return newptr;
+}
+
+/*
+ * mt_calloc: mt_malloc, zeroed
+ */
+void *mt_calloc(size_t nmemb, size_t size) {
+    size_t nobytes = nmemb * size;
+    void *ptr;
+
+    if (size != 0 && nobytes / size != nmemb)
+        return NULL;
+    if ((ptr = mt_malloc(nobytes)) != NULL)
+        memset(ptr, 0, nobytes);
+    return ptr;
+}
+
+/*
+ * mt_thread_exit: Returns the calling thread's objects to the central
+ * lists and parks its cache for the next thread
+ */
+void mt_thread_exit(void) {
+    tcache_t *tc = mine;
+    int cls;
+
+    if (!use_cache || tc == NULL || tc->gen != generation)
+        return;
+    drain_remote(tc);
+    for (cls = 0; cls < MT_NCLASS; cls++)
+        flush(tc, cls, tc->count[cls]);
+
+    pthread_mutex_lock(&idle_lock);
+    tc->next = idle;
+    idle = tc;
+    pthread_mutex_unlock(&idle_lock);
+    mine = NULL;
+}
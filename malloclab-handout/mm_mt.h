@@ -0,0 +1,25 @@
+#include <stdio.h>
+
+/*
+ * Thread-safe front end to the mm.c allocator: per-thread caches of
+ * small size classes in front of a shared mm.c heap (see mm_mt.c).
+ */
+
+/* Small classes are MT_GRAIN apart, up to MT_MAXSMALL payload bytes */
+#define MT_GRAIN     16
+#define MT_MAXSMALL  256
+#define MT_NCLASS    (MT_MAXSMALL / MT_GRAIN)
+
+/* Objects moved between a thread cache and the central lists at once */
+#define MT_BATCH     32
+
+/* Call mt_init once, after mm_init and before any thread allocates.
+   With cached == 0 every call goes straight to mm.c under one lock. */
+extern void mt_init(int cached);
+extern void *mt_malloc(size_t size);
+extern void mt_free(void *ptr);
+extern void *mt_realloc(void *ptr, size_t size);
+extern void *mt_calloc(size_t nmemb, size_t size);
+
+/* A thread calls this before it exits to hand its cache back */
+extern void mt_thread_exit(void);
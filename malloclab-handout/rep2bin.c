@@ -0,0 +1,93 @@
+/*
+ * rep2bin.c - Convert a .rep trace file to the binary format of trace.h
+ *
+ * usage: rep2bin <file.rep> <file.bin>
+ *
+ * mdriver reads either format; a binary trace is mapped rather than
+ * parsed, so it loads in no time however many ops it has.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+static void die(const char *msg, const char *filename)
+{
+    fprintf(stderr, "rep2bin: %s: %s\n", filename, msg);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    tracehdr_t hdr;
+    traceop_t *ops;
+    char type[2];
+    int num_ids, index, size, i, max_index = -1;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <file.rep> <file.bin>\n", argv[0]);
+        exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL)
+        die("could not open", argv[1]);
+
+    /* Read the trace file header */
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    if (fscanf(in, "%d %d %d %d", &hdr.weight, &num_ids,
+               &hdr.num_ops, &hdr.ignore_ranges) != 4)
+        die("bad header", argv[1]);
+    if (hdr.num_ops < 0)
+        die("bad op count", argv[1]);
+    if ((ops = calloc(hdr.num_ops + 1, sizeof(traceop_t))) == NULL)
+        die("out of memory", argv[1]);
+
+    /* Read every request line */
+    for (i = 0; i < hdr.num_ops; i++) {
+        if (fscanf(in, "%1s", type) != 1)
+            die("fewer ops than the header says", argv[1]);
+        size = 0;
+        switch (type[0]) {
+        case 'a':
+            ops[i].type = ALLOC;
+            if (fscanf(in, "%d %d", &index, &size) != 2)
+                die("bad alloc request", argv[1]);
+            break;
+        case 'r':
+            ops[i].type = REALLOC;
+            if (fscanf(in, "%d %d", &index, &size) != 2)
+                die("bad realloc request", argv[1]);
+            break;
+        case 'f':
+            ops[i].type = FREE;
+            if (fscanf(in, "%d", &index) != 1)
+                die("bad free request", argv[1]);
+            break;
+        default:
+            die("bogus type character", argv[1]);
+        }
+        if (size < 0)
+            die("negative size", argv[1]);
+        ops[i].index = index;
+        ops[i].size = size;
+        if (ops[i].type != FREE && index > max_index)
+            max_index = index;
+    }
+    fclose(in);
+    hdr.num_ids = max_index + 1;
+    if (hdr.num_ids != num_ids)
+        fprintf(stderr, "rep2bin: %s: header says %d ids, ops use %d\n",
+                argv[1], num_ids, hdr.num_ids);
+
+    if ((out = fopen(argv[2], "wb")) == NULL)
+        die("could not create", argv[2]);
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+        fwrite(ops, sizeof(traceop_t), hdr.num_ops, out) !=
+        (size_t) hdr.num_ops ||
+        fclose(out) != 0)
+        die("write failed", argv[2]);
+    free(ops);
+    return 0;
+}
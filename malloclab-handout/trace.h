@@ -0,0 +1,37 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+#include <stdint.h>
+
+/*
+ * Binary trace format, written by rep2bin and mapped by mdriver.
+ *
+ * A binary trace is a tracehdr_t followed by num_ops traceop_t records,
+ * in native byte order. The records are the driver's own traceop_t, so
+ * mdriver replays them straight out of the mapped file. num_ids is
+ * computed by rep2bin from the ops (one more than the largest id), not
+ * copied from the .rep header.
+ */
+
+#define TRACE_MAGIC "mmtrace1"  /* first 8 bytes of a binary trace */
+
+/* Request types */
+enum { ALLOC, FREE, REALLOC };
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    int32_t type;                     /* type of request */
+    int32_t index;                    /* index for free() to use later */
+    uint32_t size;                    /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* Header of a binary trace */
+typedef struct {
+    char magic[8];                    /* TRACE_MAGIC */
+    int32_t weight;                   /* weight for this trace */
+    int32_t num_ids;                  /* number of alloc/realloc ids */
+    int32_t num_ops;                  /* number of traceop_t that follow */
+    int32_t ignore_ranges;            /* as in the .rep header */
+} tracehdr_t;
+
+#endif /* __TRACE_H_ */
@@ -12,97 +12,287 @@ void init_cache() {
     }
 }
 
-cache_node *search(cache_list *cache, char *path) {
+/* String hash (djb2) over the first len bytes */
+static unsigned int hash_str(const char *s, size_t len) {
+    unsigned int h = 5381;
+    while (len--)
+        h = h * 33 + (unsigned char) *s++;
+    return h;
+}
+
+static int cmp_param(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+ * Build the cache key for host, port and path, so that trivially
+ * different spellings of a URL share one entry: the host is case-folded,
+ * the default port is dropped and query parameters are sorted.
+ */
+void normalize_key(char *key, char *host, int port, char *path) {
+    char query[MAXLINE], *params[MAXLINE / 2], *q, *saveptr;
+    int n = 0, i;
+    char *k = key;
+
+    /* Case-folded host, with the port only if it isn't the default */
+    for (i = 0; host[i]; i++)
+        *k++ = tolower((unsigned char) host[i]);
+    if (port != 80)
+        k += sprintf(k, ":%d", port);
+
+    /* Path up to the query, unchanged */
+    if ((q = strchr(path, '?')) == NULL) {
+        strcpy(k, path);
+        return;
+    }
+    memcpy(k, path, q - path + 1);
+    k += q - path + 1;
+
+    /* Query parameters in sorted order */
+    strcpy(query, q + 1);
+    for (q = strtok_r(query, "&", &saveptr); q && n < MAXLINE / 2;
+         q = strtok_r(NULL, "&", &saveptr))
+        params[n++] = q;
+    qsort(params, n, sizeof(char *), cmp_param);
+    for (i = 0; i < n; i++)
+        k += sprintf(k, "%s%s", i ? "&" : "", params[i]);
+    *k = '\0';
+}
+
+/* Length of the host part of a key, i.e. up to the path */
+static size_t host_len(const char *key) {
+    const char *slash = strchr(key, '/');
+    return slash ? (size_t) (slash - key) : strlen(key);
+}
+
+/*
+ * Find the index for the host part of key, creating it when create
+ * is set. The host string is interned here, once per origin. Returns
+ * NULL if there is none, or if it cannot be allocated.
+ */
+static host_index *get_host(cache_list *cache, const char *key, int create) {
+    size_t len = host_len(key);
+    unsigned int b = hash_str(key, len) % HOST_BUCKETS;
+    host_index *h;
+
+    for (h = cache->hosts[b]; h != NULL; h = h->next) {
+        if (!strncmp(h->host, key, len) && h->host[len] == '\0')
+            return h;
+    }
+    if (!create)
+        return NULL;
+    if ((h = Calloc_r(1, sizeof(host_index))) == NULL)
+        return NULL;
+    if ((h->host = Malloc_r(len + 1)) == NULL) {
+        free(h);
+        return NULL;
+    }
+    memcpy(h->host, key, len);
+    h->host[len] = '\0';
+    h->next = cache->hosts[b];
+    cache->hosts[b] = h;
+    return h;
+}
+
+/* First position in h->nodes whose path is >= path */
+static unsigned int lower_bound(host_index *h, const char *path) {
+    unsigned int lo = 0, hi = h->count, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (strcmp(h->nodes[mid]->path, path) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * Copy the object cached under key into content, which must hold
+ * MAX_OBJECT_SIZE bytes. The copy is made under the lock, since a PURGE
+ * or an eviction may free the node as soon as it is released. Returns
+ * the object size, or -1 if key is not cached.
+ */
+int search(cache_list *cache, char *key, char *content) {
     int status = pthread_rwlock_rdlock(&cache_lk);
+    int size;
     /* Incrementing time counter */
     time_ctr++;
-    cache_node *ptr = cache->head;/* pointer to traverse through cache */
+    cache_node *ptr = cache->keys[hash_str(key, strlen(key)) % KEY_BUCKETS];
     while(ptr != NULL) {
-        /* Checking if the path is already present in the cache */
-    	if(!strcmp(ptr->path, path)) {
+        /* Checking if the key is already present in the cache */
+    	if(!strcmp(ptr->key, key)) {
     		/* Updating the time of node as it is read */
             ptr->time = time_ctr;
+            memcpy(content, ptr->content, ptr->size);
+            size = ptr->size;
             status = pthread_rwlock_unlock(&cache_lk);
-            return ptr;
+            return size;
         }
-        ptr = ptr->next;
+        ptr = ptr->hnext;
     }
     status = pthread_rwlock_unlock(&cache_lk);
-    return NULL;
+    return -1;
 }
 
 
-void add_node(cache_list *cache, char *path, char *content, unsigned int size) {
+void add_node(cache_list *cache, char *key, char *content, unsigned int size) {
     int status = pthread_rwlock_wrlock(&cache_lk);
+    unsigned int b = hash_str(key, strlen(key)) % KEY_BUCKETS;
+    cache_node *ptr, *new_entry;
+    cache_node **nodes;
+    host_index *h;
+    unsigned int pos;
+
+    /* Another thread may have fetched the same object meanwhile */
+    for (ptr = cache->keys[b]; ptr != NULL; ptr = ptr->hnext) {
+        if (!strcmp(ptr->key, key)) {
+            status = pthread_rwlock_unlock(&cache_lk);
+            return;
+        }
+    }
 
     /* Evict until a fit is found */
     while((cache->size + size) > MAX_CACHE_SIZE)
     	evict_node(cache);
-    time_ctr++;
-    cache_node *new_entry = Malloc(sizeof(cache_node));
-    
+
+    /*
+     * Allocate everything before linking anything in, so that running
+     * out of memory just means the object is not cached
+     */
+    if ((h = get_host(cache, key, 1)) == NULL)
+        goto nomem;
+    if (h->count == h->cap) {
+        if ((nodes = Realloc_r(h->nodes, (h->cap ? 2 * h->cap : 8) *
+                               sizeof(cache_node *))) == NULL)
+            goto nomem;
+        h->nodes = nodes;
+        h->cap = h->cap ? 2 * h->cap : 8;
+    }
+    if ((new_entry = Calloc_r(1, sizeof(cache_node))) == NULL)
+        goto nomem;
+    new_entry->content = Malloc_r(MAX_OBJECT_SIZE); // here we can malloc only the required size
+    new_entry->key = Malloc_r(strlen(key) + 1);
+    if (new_entry->content == NULL || new_entry->key == NULL) {
+        free(new_entry->content);
+        free(new_entry->key);
+        free(new_entry);
+        goto nomem;
+    }
+
     /* Updating the values in the new node */
-    new_entry->content = Malloc(MAX_OBJECT_SIZE); // here we can malloc only the required size 
-    new_entry->path = Malloc(MAXLINE);
+    time_ctr++;
     memcpy(new_entry->content, content, size);/* Copy byte by byte */
     new_entry->size = size;
     new_entry->time = time_ctr;
-    strcpy(new_entry->path, path);
+    strcpy(new_entry->key, key);
+    new_entry->path = new_entry->key + host_len(key);
     /* Updating cache size */
     cache->size = cache->size + size;
 
     /* New node will be added as head of cache to make it faster */
+    new_entry->prev = NULL;
     new_entry->next = cache->head;
-    cache->head = new_entry;  
+    if (cache->head != NULL)
+        cache->head->prev = new_entry;
+    cache->head = new_entry;
+
+    /* Key table */
+    new_entry->hnext = cache->keys[b];
+    cache->keys[b] = new_entry;
+
+    /* Secondary index, kept in path order */
+    pos = lower_bound(h, new_entry->path);
+    memmove(&h->nodes[pos + 1], &h->nodes[pos],
+            (h->count - pos) * sizeof(cache_node *));
+    h->nodes[pos] = new_entry;
+    h->count++;
+    new_entry->host = h;
     status = pthread_rwlock_unlock(&cache_lk);
+    return;
+
+nomem:
+    printf("Not caching %s: %s\n", key, strerror(last_error()));
+    status = pthread_rwlock_unlock(&cache_lk);
+}
+
+/*
+ * Remove a node from the LRU list and the key table and free it.
+ * The caller takes care of the host index and holds the write lock.
+ */
+static void unlink_node(cache_list *cache, cache_node *node) {
+    cache_node **pp = &cache->keys[hash_str(node->key, strlen(node->key))
+                                   % KEY_BUCKETS];
+
+    while (*pp != node)
+        pp = &(*pp)->hnext;
+    *pp = node->hnext;
+
+    if (node->prev != NULL)
+        node->prev->next = node->next;
+    else
+        cache->head = node->next;
+    if (node->next != NULL)
+        node->next->prev = node->prev;
+
+    cache->size = cache->size - node->size;
+    free(node->content);
+    free(node->key);
+    free(node);
 }
 
+/* Called from add_node with the write lock held */
 void evict_node(cache_list *cache) {
-    int status = pthread_rwlock_wrlock(&cache_lk);
-	
-    /* Initialize least time as time of head node initially */
+    host_index *h;
+    unsigned int pos;
+
+    /* Find the least recently used node */
     cache_node *ptr = cache->head;
-    unsigned int least_time = cache->head->time;
+    cache_node *lru = cache->head;
     while(ptr != NULL)
     {
-        if(ptr->time < least_time)
-            least_time = ptr->time;
+        if(ptr->time < lru->time)
+            lru = ptr;
         ptr = ptr->next;
     }
-
-    /* Section to delete the appropriate node */
-    ptr = cache->head;
-    cache_node *temp;
-    /* If node to be evicted is at head */
-    if( cache->head->time == least_time)
-    {
-        temp = cache->head;
-        cache->head = cache->head->next;
-        cache->size =cache->size - (temp->size);
-        free(temp->content);
-        free(temp->path);
-        free(temp);
-        status = pthread_rwlock_unlock(&cache_lk);
+    if (lru == NULL)
         return;
-    }
 
-    /* If node to be evicted is not the head */
-    while(ptr->next != NULL)
-    {	
-        if(ptr->next->time == least_time)
-        {
-            temp = ptr->next;
-            ptr->next = ptr->next->next;
-            cache->size = cache->size - (temp->size);
-        	free(temp->content);
-        	free(temp->path);
-        	free(temp);
-                status = pthread_rwlock_unlock(&cache_lk);
-        	return;
-        }
+    /* Drop it from its host index, then from everything else */
+    h = lru->host;
+    pos = lower_bound(h, lru->path);
+    memmove(&h->nodes[pos], &h->nodes[pos + 1],
+            (h->count - pos - 1) * sizeof(cache_node *));
+    h->count--;
+    unlink_node(cache, lru);
+}
 
-        ptr = ptr->next;
+/*
+ * Drop every object whose normalized key starts with prefix, e.g.
+ * "example.com/images/". Only the matching run of the origin's index
+ * is visited. Returns the number of objects dropped.
+ */
+int purge_prefix(cache_list *cache, char *prefix) {
+    int status = pthread_rwlock_wrlock(&cache_lk);
+    char *path = prefix + host_len(prefix);
+    size_t plen = strlen(path);
+    host_index *h;
+    unsigned int first, last;
+
+    if ((h = get_host(cache, prefix, 0)) == NULL) {
+        status = pthread_rwlock_unlock(&cache_lk);
+        return 0;
+    }
+    first = lower_bound(h, path);
+    for (last = first; last < h->count; last++) {
+        if (strncmp(h->nodes[last]->path, path, plen))
+            break;
+        unlink_node(cache, h->nodes[last]);
     }
+    memmove(&h->nodes[first], &h->nodes[last],
+            (h->count - last) * sizeof(cache_node *));
+    h->count -= last - first;
     status = pthread_rwlock_unlock(&cache_lk);
-    //return;
+    return last - first;
 }
@@ -4,21 +4,46 @@
 #define MAX_CACHE_SIZE 1049000
 #define MAX_OBJECT_SIZE 102400
 
+#define KEY_BUCKETS  1024  /* buckets in the key -> node table */
+#define HOST_BUCKETS 256   /* buckets in the host -> host_index table */
+
+struct host_index;
+
 typedef struct cache_node {
   unsigned int size;
   unsigned int time;
-  char *path;
+  char *key;                   /* normalized "host[:port]/path[?query]" */
+  char *path;                  /* points into key, at the path */
   char *content;
-  struct cache_node *next;
+  struct cache_node *next;     /* all nodes, searched for LRU eviction */
+  struct cache_node *prev;
+  struct cache_node *hnext;    /* chain in the key table */
+  struct host_index *host;     /* secondary index this node is in */
 } cache_node;
 
+/*
+ * Secondary index: the cached objects of one origin, kept sorted by
+ * path so that a prefix is one contiguous run
+ */
+typedef struct host_index {
+  char *host;                  /* interned "host[:port]", shared by keys */
+  cache_node **nodes;          /* sorted by path */
+  unsigned int count;
+  unsigned int cap;
+  struct host_index *next;     /* chain in the host table */
+} host_index;
+
 typedef struct cache_list{
   cache_node *head;
   unsigned int size;
+  cache_node *keys[KEY_BUCKETS];
+  host_index *hosts[HOST_BUCKETS];
 } cache_list;
 
 void init_cache();
-void add_node(cache_list *cache, char *path, char *content, unsigned int size);
+void normalize_key(char *key, char *host, int port, char *path);
+void add_node(cache_list *cache, char *key, char *content, unsigned int size);
 void evict_node(cache_list *cache);
-cache_node *search(cache_list *cache, char *path);
+int search(cache_list *cache, char *key, char *content);
+int purge_prefix(cache_list *cache, char *prefix);
 
@@ -11,26 +11,26 @@
 void unix_error(char *msg) /* unix-style error */
 {
     fprintf(stderr, "%s: %s\n", msg, strerror(errno));
-    //exit(0);
+    exit(0);
 }
 /* $end unixerror */
 
 void posix_error(int code, char *msg) /* posix-style error */
 {
     fprintf(stderr, "%s: %s\n", msg, strerror(code));
-    //exit(0);
+    exit(0);
 }
 
 void dns_error(char *msg) /* dns-style error */
 {
     fprintf(stderr, "%s: DNS error %d\n", msg, h_errno);
-    //exit(0);
+    exit(0);
 }
 
 void app_error(char *msg) /* application error */
 {
     fprintf(stderr, "%s\n", msg);
-    //exit(0);
+    exit(0);
 }
 /* $end errorfuns */
 
@@ -575,6 +575,54 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 /* $end rio_writen */
 
 
+/*
+ * rio_wait - wait up to rp->rio_timeout ms for rp->rio_fd to become
+ *    readable. Returns 1 if it is, 0 (errno = ETIMEDOUT) on timeout
+ *    and -1 on error.
+ */
+static int rio_wait(rio_t *rp)
+{
+    struct pollfd pfd;
+    int rc;
+
+    pfd.fd = rp->rio_fd;
+    pfd.events = POLLIN;
+    while ((rc = poll(&pfd, 1, rp->rio_timeout)) < 0) {
+	if (errno != EINTR)
+	    return -1;
+    }
+    if (rc == 0)
+	errno = ETIMEDOUT;
+    return rc;
+}
+
+/*
+ * rio_fill - Move the unread bytes to the front of the internal buffer
+ *    and read() more after them. Returns the number of bytes added,
+ *    0 on EOF and -1 on error.
+ */
+static ssize_t rio_fill(rio_t *rp)
+{
+    ssize_t rc;
+
+    if (rp->rio_bufptr != rp->rio_buf) {
+	memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+	rp->rio_bufptr = rp->rio_buf;
+    }
+    while (1) {
+	if (rp->rio_timeout > 0 && rio_wait(rp) <= 0)
+	    return -1;  /* errno is ETIMEDOUT or set by poll() */
+	rc = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt,
+		  rp->rio_bufsize - rp->rio_cnt);
+	if (rc >= 0)
+	    break;
+	if (errno != EINTR) /* interrupted by sig handler return */
+	    return -1;
+    }
+    rp->rio_cnt += rc;
+    return rc;
+}
+
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
  *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
@@ -586,19 +634,12 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 /* $begin rio_read */
 static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 {
+    ssize_t rc;
     int cnt;
 
-    while (rp->rio_cnt <= 0) {  /* refill if buf is empty */
-	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
-			   sizeof(rp->rio_buf));
-	if (rp->rio_cnt < 0) {
-	    if (errno != EINTR) /* interrupted by sig handler return */
-		return -1;
-	}
-	else if (rp->rio_cnt == 0)  /* EOF */
-	    return 0;
-	else 
-	    rp->rio_bufptr = rp->rio_buf; /* reset buffer ptr */
+    if (rp->rio_cnt <= 0) {  /* refill if buf is empty */
+	if ((rc = rio_fill(rp)) <= 0)
+	    return rc;  /* EOF or error */
     }
 
     /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
@@ -612,6 +653,37 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 }
 /* $end rio_read */
 
+/*
+ * rio_readv - Read straight into usrbuf, for requests of at least a
+ *    buffer's worth. The internal buffer, which must be empty, is the
+ *    second element of a readv(), so whatever else has arrived is
+ *    picked up by the same system call.
+ */
+static ssize_t rio_readv(rio_t *rp, char *usrbuf, size_t n)
+{
+    struct iovec iov[2];
+    ssize_t rc;
+
+    iov[0].iov_base = usrbuf;
+    iov[0].iov_len = n;
+    iov[1].iov_base = rp->rio_buf;
+    iov[1].iov_len = rp->rio_bufsize;
+    while (1) {
+	if (rp->rio_timeout > 0 && rio_wait(rp) <= 0)
+	    return -1;
+	if ((rc = readv(rp->rio_fd, iov, 2)) >= 0)
+	    break;
+	if (errno != EINTR) /* interrupted by sig handler return */
+	    return -1;
+    }
+    if (rc > n) {  /* the rest went to the internal buffer */
+	rp->rio_bufptr = rp->rio_buf;
+	rp->rio_cnt = rc - n;
+	return n;
+    }
+    return rc;
+}
+
 /*
  * rio_readinitb - Associate a descriptor with a read buffer and reset buffer
  */
@@ -620,12 +692,40 @@ void rio_readinitb(rio_t *rp, int fd)
 {
     rp->rio_fd = fd;  
     rp->rio_cnt = 0;  
+    rp->rio_timeout = 0;
+    rp->rio_buf = rp->rio_ibuf;
+    rp->rio_bufsize = RIO_BUFSIZE;
     rp->rio_bufptr = rp->rio_buf;
 }
 /* $end rio_readinitb */
 
 /*
- * rio_readnb - Robustly read n bytes (buffered)
+ * rio_setbuf - Use the caller's size bytes at buf as the internal
+ *    buffer from now on, e.g. a small one for many idle connections or
+ *    a bigger one to grow past RIO_BUFSIZE. Unread bytes are carried
+ *    over, so it may be called at any time with size >= rio_cnt.
+ */
+void rio_setbuf(rio_t *rp, char *buf, size_t size)
+{
+    memmove(buf, rp->rio_bufptr, rp->rio_cnt);
+    rp->rio_buf = buf;
+    rp->rio_bufsize = size;
+    rp->rio_bufptr = buf;
+}
+
+/*
+ * rio_settimeout - Bound every refill of the internal buffer to
+ *    timeout_ms of idle time; a value <= 0 blocks forever.  A read that
+ *    times out fails with errno set to ETIMEDOUT.
+ */
+void rio_settimeout(rio_t *rp, int timeout_ms)
+{
+    rp->rio_timeout = timeout_ms;
+}
+
+/*
+ * rio_readnb - Robustly read n bytes (buffered; reads of at least a
+ *    buffer's worth go around the buffer once it is drained)
  */
 /* $begin rio_readnb */
 ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n) 
@@ -635,7 +735,11 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
     char *bufp = usrbuf;
     
     while (nleft > 0) {
-	if ((nread = rio_read(rp, bufp, nleft)) < 0) {
+	if (rp->rio_cnt <= 0 && nleft >= rp->rio_bufsize)
+	    nread = rio_readv(rp, bufp, nleft); /* bypass the buffer */
+	else
+	    nread = rio_read(rp, bufp, nleft);
+	if (nread < 0) {
 	    if (errno == EINTR) /* interrupted by sig handler return */
 		nread = 0;      /* call read() again */
 	    else
@@ -651,31 +755,217 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 /* $end rio_readnb */
 
 /* 
- * rio_readlineb - robustly read a text line (buffered)
+ * rio_readline - robustly read a text line (buffered). Whole runs of
+ *    the internal buffer are searched with memchr() and copied at once.
+ *    Returns the number of bytes stored (without the terminating NUL),
+ *    0 on EOF and -1 on error.
+ */
+ssize_t rio_readline(rio_t *rp, void *usrbuf, size_t maxlen) 
+{
+    size_t n = 0, cnt;
+    ssize_t rc;
+    char *bufp = usrbuf, *nl = NULL;
+
+    if (maxlen == 0)
+	return 0;
+    while (n + 1 < maxlen && nl == NULL) {
+	if (rp->rio_cnt <= 0) {
+	    if ((rc = rio_fill(rp)) < 0)
+		return -1;	  /* error */
+	    if (rc == 0)
+		break;		  /* EOF */
+	}
+	cnt = rp->rio_cnt;
+	if (cnt > maxlen - 1 - n)
+	    cnt = maxlen - 1 - n;
+	if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+	    cnt = nl - rp->rio_bufptr + 1;
+	memcpy(bufp + n, rp->rio_bufptr, cnt);
+	rp->rio_bufptr += cnt;
+	rp->rio_cnt -= cnt;
+	n += cnt;
+    }
+    bufp[n] = 0;
+    return n;
+}
+
+/*
+ * rio_getline - zero-copy rio_readline: point *linep at the next line,
+ *    '\n' included but not NUL-terminated, inside the internal buffer
+ *    and return its length. The line stays valid until the next read
+ *    from rp. A line that does not fit in the buffer comes back in
+ *    buffer-sized pieces without a '\n'. Returns 0 on EOF, -1 on error.
+ */
+ssize_t rio_getline(rio_t *rp, char **linep)
+{
+    size_t scanned = 0, n;
+    ssize_t rc;
+    char *nl;
+
+    while ((nl = memchr(rp->rio_bufptr + scanned, '\n',
+			rp->rio_cnt - scanned)) == NULL) {
+	scanned = rp->rio_cnt;
+	if (rp->rio_cnt == rp->rio_bufsize)
+	    break;		  /* line is longer than the buffer */
+	if ((rc = rio_fill(rp)) < 0)
+	    return -1;
+	if (rc == 0)
+	    break;		  /* EOF: hand out what is left */
+    }
+    n = nl ? nl - rp->rio_bufptr + 1 : rp->rio_cnt;
+    *linep = rp->rio_bufptr;
+    rp->rio_bufptr += n;
+    rp->rio_cnt -= n;
+    return n;
+}
+
+/* 
+ * rio_readlineb - robustly read a text line (buffered); the original
+ *    interface, now a wrapper for rio_readline()
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
+    return rio_readline(rp, usrbuf, maxlen);
+}
+/* $end rio_readlineb */
 
-    for (n = 1; n < maxlen; n++) { 
-	if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n')
-		break;
-	} else if (rc == 0) {
-	    if (n == 1)
-		return 0; /* EOF, no data read */
-	    else
-		break;    /* EOF, some data was read */
+/*
+ * rio_sendv - write all of iov[0..cnt-1]. Sockets get sendmsg(), so
+ *    that flags (MSG_MORE) apply; other descriptors get writev().
+ *    Returns 0, or -1 with errno set. iov is used up in the process.
+ */
+static int rio_sendv(rio_writer_t *wp, struct iovec *iov, int cnt, int flags)
+{
+    struct msghdr msg;
+    ssize_t n;
+
+    while (cnt > 0) {
+	if (iov->iov_len == 0) {
+	    iov++;
+	    cnt--;
+	    continue;
+	}
+	if (!wp->rio_notsock) {
+	    memset(&msg, 0, sizeof(msg));
+	    msg.msg_iov = iov;
+	    msg.msg_iovlen = cnt;
+	    n = sendmsg(wp->rio_fd, &msg, flags);
+	    if (n < 0 && errno == ENOTSOCK) {
+		wp->rio_notsock = 1;
+		continue;
+	    }
 	} else
-	    return -1;	  /* error */
+	    n = writev(wp->rio_fd, iov, cnt);
+	if (n < 0) {
+	    if (errno == EINTR)  /* interrupted by sig handler return */
+		continue;
+	    return -1;
+	}
+	/* Skip what was written */
+	while (cnt > 0 && n >= iov->iov_len) {
+	    n -= iov->iov_len;
+	    iov++;
+	    cnt--;
+	}
+	if (cnt > 0) {
+	    iov->iov_base = (char *)iov->iov_base + n;
+	    iov->iov_len -= n;
+	}
+    }
+    return 0;
+}
+
+/*
+ * rio_writerinit - Associate a descriptor with an output buffer
+ */
+void rio_writerinit(rio_writer_t *wp, int fd)
+{
+    wp->rio_fd = fd;
+    wp->rio_notsock = 0;
+    wp->rio_wcnt = 0;
+}
+
+/*
+ * rio_writeb - Append n bytes to the output (buffered). Bytes that do
+ *    not fit go out in one writev() together with what is buffered, so
+ *    a large body costs no extra copy. Returns n, or -1 on error.
+ */
+ssize_t rio_writeb(rio_writer_t *wp, void *usrbuf, size_t n)
+{
+    struct iovec iov[2];
+
+    if (n <= RIO_WBUFSIZE - wp->rio_wcnt) {
+	memcpy(wp->rio_wbuf + wp->rio_wcnt, usrbuf, n);
+	wp->rio_wcnt += n;
+	return n;
     }
-    *bufp = 0;
+    iov[0].iov_base = wp->rio_wbuf;
+    iov[0].iov_len = wp->rio_wcnt;
+    iov[1].iov_base = usrbuf;
+    iov[1].iov_len = n;
+    wp->rio_wcnt = 0;
+    if (rio_sendv(wp, iov, 2, 0) < 0)
+	return -1;
     return n;
 }
-/* $end rio_readlineb */
+
+/*
+ * rio_printfb - printf() to the output (buffered). Returns the length
+ *    written, or -1 on error (EMSGSIZE if it exceeds RIO_WBUFSIZE).
+ */
+ssize_t rio_printfb(rio_writer_t *wp, const char *fmt, ...)
+{
+    va_list ap;
+    size_t room;
+    int n;
+
+    va_start(ap, fmt);
+    room = RIO_WBUFSIZE - wp->rio_wcnt;
+    n = vsnprintf(wp->rio_wbuf + wp->rio_wcnt, room, fmt, ap);
+    va_end(ap);
+    if (n >= 0 && n >= room && wp->rio_wcnt > 0) {
+	/* Make room, then format again */
+	if (rio_flushb(wp, 1) < 0)
+	    return -1;
+	va_start(ap, fmt);
+	room = RIO_WBUFSIZE;
+	n = vsnprintf(wp->rio_wbuf, room, fmt, ap);
+	va_end(ap);
+    }
+    if (n < 0 || n >= room) {
+	if (n >= 0)
+	    errno = EMSGSIZE;
+	return -1;
+    }
+    wp->rio_wcnt += n;
+    return n;
+}
+
+/*
+ * rio_flushb - Write out everything buffered. If more is set the data
+ *    is sent with MSG_MORE, so the kernel may hold a partial segment
+ *    for what follows (e.g. a sendfile() body). Returns 0, or -1.
+ */
+ssize_t rio_flushb(rio_writer_t *wp, int more)
+{
+    struct iovec iov;
+
+    iov.iov_base = wp->rio_wbuf;
+    iov.iov_len = wp->rio_wcnt;
+    wp->rio_wcnt = 0;
+    return rio_sendv(wp, &iov, 1, more ? MSG_MORE : 0);
+}
+
+/*
+ * rio_cork - Set (on) or clear TCP_CORK on a socket, for responses
+ *    written partly by someone else, such as a CGI child. While corked
+ *    only full segments are sent; uncorking pushes out the rest.
+ */
+int rio_cork(int fd, int on)
+{
+    return setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
 
 /**********************************
  * Wrappers for robust I/O routines
@@ -718,6 +1008,121 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
     return rc;
 } 
 
+/*************************************************************
+ * Non-exiting wrappers for server code paths. On error these
+ * return -1 (NULL for the allocators) and leave the cause in a
+ * thread-local last error instead of calling unix_error(), so
+ * that a failure costs one connection rather than the process.
+ *************************************************************/
+static __thread int last_errno;
+static __thread const char *last_op;
+
+/* set_error - record errno as the cause of op's failure */
+static int set_error(const char *op)
+{
+    last_errno = errno;
+    last_op = op;
+    return -1;
+}
+
+/* last_error - errno of this thread's last failed *_r call */
+int last_error(void)
+{
+    return last_errno;
+}
+
+/* last_error_op - name of this thread's last failed *_r call */
+const char *last_error_op(void)
+{
+    return last_op ? last_op : "none";
+}
+
+pid_t Fork_r(void) 
+{
+    pid_t pid;
+
+    if ((pid = fork()) < 0)
+	set_error("Fork_r");
+    return pid;
+}
+
+int Close_r(int fd) 
+{
+    if (close(fd) < 0)
+	return set_error("Close_r");
+    return 0;
+}
+
+void *Malloc_r(size_t size) 
+{
+    void *p;
+
+    if ((p = malloc(size)) == NULL)
+	set_error("Malloc_r");
+    return p;
+}
+
+void *Calloc_r(size_t nmemb, size_t size) 
+{
+    void *p;
+
+    if ((p = calloc(nmemb, size)) == NULL)
+	set_error("Calloc_r");
+    return p;
+}
+
+void *Realloc_r(void *ptr, size_t size) 
+{
+    void *p;
+
+    if ((p = realloc(ptr, size)) == NULL)
+	set_error("Realloc_r");
+    return p;
+}
+
+int Accept_r(int s, struct sockaddr *addr, socklen_t *addrlen) 
+{
+    int rc;
+
+    if ((rc = accept(s, addr, addrlen)) < 0)
+	return set_error("Accept_r");
+    return rc;
+}
+
+ssize_t Rio_readn_r(int fd, void *ptr, size_t nbytes) 
+{
+    ssize_t n;
+  
+    if ((n = rio_readn(fd, ptr, nbytes)) < 0)
+	return set_error("Rio_readn_r");
+    return n;
+}
+
+ssize_t Rio_writen_r(int fd, void *usrbuf, size_t n) 
+{
+    if (rio_writen(fd, usrbuf, n) != n)
+	return set_error("Rio_writen_r");
+    return n;
+}
+
+ssize_t Rio_readnb_r(rio_t *rp, void *usrbuf, size_t n) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_readnb(rp, usrbuf, n)) < 0)
+	return set_error("Rio_readnb_r");
+    return rc;
+}
+
+ssize_t Rio_readlineb_r(rio_t *rp, void *usrbuf, size_t maxlen) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_readlineb(rp, usrbuf, maxlen)) < 0)
+	return set_error("Rio_readlineb_r");
+    return rc;
+}
+
 /******************************** 
  * Client/server helper functions
  ********************************/
@@ -757,43 +1162,207 @@ int open_clientfd(char *hostname, int port)
 /* $end open_clientfd */
 
 /*
- * open_clientfd_r - thread-safe version of open_clientfd
+ * open_clientfd_r - thread-safe version of open_clientfd. Resolves
+ *   both IPv6 and IPv4 addresses and races them (open_clientfd_he).
+ *   Returns -1 and sets errno on Unix error, -2 on DNS error (with
+ *   errno EHOSTUNREACH, or the cause of a system error in the lookup).
  */
 int open_clientfd_r(char *hostname, int port) {
-    int clientfd;
-    struct addrinfo *addlist, *p;
+    struct addrinfo hints, *addlist;
     char port_str[MAXLINE];
-    int rv;
-
-    /* Create the socket descriptor */
-    if ((clientfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        return -1;
-    }
+    int clientfd, rc;
 
-    /* Get a list of addrinfo structs */
+    /* Get a list of addrinfo structs, of any address family */
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
     sprintf(port_str, "%d", port);
-    if ((rv = getaddrinfo(hostname, port_str, NULL, &addlist)) != 0) {
-        return -1;
+    if ((rc = getaddrinfo(hostname, port_str, &hints, &addlist)) != 0) {
+        if (rc != EAI_SYSTEM)
+            errno = EHOSTUNREACH;
+        return -2;
     }
-  
-    /* Walk the list, using each addrinfo to try to connect */
-    for (p = addlist; p; p = p->ai_next) {
-        if ((p->ai_family == AF_INET)) {
-            if (connect(clientfd, p->ai_addr, p->ai_addrlen) == 0) {
-                break; /* success */
-            }
-        }
-    } 
-
-    /* Clean up */
+
+    clientfd = open_clientfd_he(addlist, HE_STAGGER_MS, 0, NULL);
     freeaddrinfo(addlist);
-    if (!p) { /* all connects failed */
-        close(clientfd);
-        return -1;
+    return clientfd;
+}
+
+/* clock_ms - monotonic time in milliseconds */
+static long clock_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * he_order - fill order with up to HE_MAXADDRS entries of addrs,
+ *   alternating address families (RFC 8305, section 4) and starting
+ *   with the family getaddrinfo() ranked first. Returns the count.
+ */
+static int he_order(struct addrinfo *addrs, struct addrinfo **order)
+{
+    struct addrinfo *p, *first[HE_MAXADDRS], *other[HE_MAXADDRS];
+    int nfirst = 0, nother = 0, i = 0, j = 0, n = 0;
+
+    for (p = addrs; p; p = p->ai_next) {
+	if (p->ai_family == addrs->ai_family) {
+	    if (nfirst < HE_MAXADDRS)
+		first[nfirst++] = p;
+	} else if (nother < HE_MAXADDRS)
+	    other[nother++] = p;
     }
-    else { /* one of the connects succeeded */
-        return clientfd;
+    while (n < HE_MAXADDRS && (i < nfirst || j < nother)) {
+	if (i < nfirst)
+	    order[n++] = first[i++];
+	if (j < nother && n < HE_MAXADDRS)
+	    order[n++] = other[j++];
     }
+    return n;
+}
+
+/*
+ * open_clientfd_he - "Happy Eyeballs" connect (RFC 8305) to the
+ *   resolved addresses addrs: start a non-blocking connect to one
+ *   address every stagger_ms, sooner when an attempt fails, with the
+ *   families interleaved, and keep the first that succeeds. A broken
+ *   IPv6 (or IPv4) path then costs stagger_ms rather than a connect
+ *   timeout. Gives up after timeout_ms in all, or never if it is <= 0.
+ *   Returns a blocking descriptor, and the address it reached in
+ *   *used unless used is NULL, or -1 with errno set.
+ */
+int open_clientfd_he(struct addrinfo *addrs, int stagger_ms, int timeout_ms,
+		     struct addrinfo **used)
+{
+    struct addrinfo *order[HE_MAXADDRS], *pending[HE_MAXADDRS];
+    struct pollfd pfds[HE_MAXADDRS];
+    int n, next = 0, npend = 0, i, rc, wait, fd = -1, err = ECONNREFUSED;
+    long now, start = clock_ms(), next_at = start;
+
+    n = he_order(addrs, order);
+    while (fd < 0) {
+	now = clock_ms();
+	if (timeout_ms > 0 && now - start >= timeout_ms) {
+	    err = ETIMEDOUT;
+	    break;
+	}
+
+	/* Time for the next attempt, or nothing left in flight */
+	if (next < n && (now >= next_at || npend == 0)) {
+	    if ((pfds[npend].fd = open_clientfd_start(order[next])) >= 0) {
+		pfds[npend].events = POLLOUT;
+		pending[npend++] = order[next];
+	    } else
+		err = errno;
+	    next++;
+	    next_at = now + stagger_ms;
+	    continue;
+	}
+	if (npend == 0)
+	    break;  /* every address failed */
+
+	wait = (next < n) ? next_at - now : -1;
+	if (timeout_ms > 0 && (wait < 0 || start + timeout_ms - now < wait))
+	    wait = start + timeout_ms - now;
+	if ((rc = poll(pfds, npend, wait)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    err = errno;
+	    break;
+	}
+	for (i = 0; i < npend && fd < 0; i++) {
+	    if (!pfds[i].revents)
+		continue;
+	    if (open_clientfd_finish(pfds[i].fd, 0) == 0) {
+		fd = pfds[i].fd;
+		if (used)
+		    *used = pending[i];
+		pfds[i] = pfds[--npend];  /* the rest are closed below */
+		break;
+	    }
+	    /* This one failed (and is closed): try the next one now */
+	    err = errno;
+	    pfds[i] = pfds[--npend];
+	    pending[i] = pending[npend];
+	    i--;
+	    next_at = now;
+	}
+    }
+
+    for (i = 0; i < npend; i++)
+	close(pfds[i].fd);
+    if (fd < 0)
+	errno = err;
+    return fd;
+}
+
+/*
+ * open_clientfd_start - create a socket for ai and start a non-blocking
+ *   connect. Returns the descriptor, which stays in non-blocking mode
+ *   until open_clientfd_finish() is called, or -1 on error.
+ */
+int open_clientfd_start(const struct addrinfo *ai)
+{
+    int clientfd;
+
+    if ((clientfd = socket(ai->ai_family, SOCK_STREAM, 0)) < 0)
+	return -1;
+    if (fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL) | O_NONBLOCK) < 0 ||
+	(connect(clientfd, ai->ai_addr, ai->ai_addrlen) < 0 &&
+	 errno != EINPROGRESS)) {
+	close(clientfd);
+	return -1;
+    }
+    return clientfd;
+}
+
+/*
+ * open_clientfd_finish - wait up to timeout_ms for a connect started by
+ *   open_clientfd_start() and put the descriptor back in blocking mode.
+ *   Returns 0 on success. On failure (errno = ETIMEDOUT if the deadline
+ *   passed) the descriptor is closed and -1 is returned.
+ */
+int open_clientfd_finish(int clientfd, int timeout_ms)
+{
+    struct pollfd pfd;
+    int rc, err = 0;
+    socklen_t len = sizeof(err);
+
+    pfd.fd = clientfd;
+    pfd.events = POLLOUT;
+    while ((rc = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR)
+	;
+    if (rc == 0)
+	err = ETIMEDOUT;
+    else if (rc < 0 ||
+	     getsockopt(clientfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+	err = errno;
+    if (!err &&
+	fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL) & ~O_NONBLOCK) < 0)
+	err = errno;
+    if (err) {
+	close(clientfd);
+	errno = err;
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * open_clientfd_timeout - connect to ai, giving up after timeout_ms.
+ *   Returns a blocking socket descriptor, or -1 with errno set.
+ */
+int open_clientfd_timeout(const struct addrinfo *ai, int timeout_ms)
+{
+    int clientfd;
+
+    if ((clientfd = open_clientfd_start(ai)) < 0)
+	return -1;
+    if (open_clientfd_finish(clientfd, timeout_ms) < 0)
+	return -1;
+    return clientfd;
 }
 
 /*  
@@ -847,14 +1416,15 @@ int Open_clientfd(char *hostname, int port)
     return rc;
 }
 
+/* Open_clientfd_r - like the other *_r wrappers, does not exit */
 int Open_clientfd_r(char *hostname, int port) 
 {
-    /* Initialize rc for error handling purposes in the proxy */
-    int rc = -1;
+    int rc;
 
-    if ((rc = open_clientfd_r(hostname, port)) < 0) {
-        unix_error("Open_clientfd_r error");
-    }
+    if ((rc = open_clientfd_r(hostname, port)) == -2)
+	set_error("Open_clientfd_r DNS lookup");
+    else if (rc < 0)
+	set_error("Open_clientfd_r");
     return rc;
 }
 
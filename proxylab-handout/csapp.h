@@ -9,6 +9,7 @@
 #include <ctype.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -20,9 +21,12 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <poll.h>
 
 
 /* Default file permissions are DEF_MODE & ~DEF_UMASK */
@@ -42,11 +46,23 @@ typedef struct sockaddr SA;
 typedef struct {
     int rio_fd;                /* descriptor for this internal buf */
     int rio_cnt;               /* unread bytes in internal buf */
+    int rio_timeout;           /* ms to wait for data, <= 0 blocks */
     char *rio_bufptr;          /* next unread byte in internal buf */
-    char rio_buf[RIO_BUFSIZE]; /* internal buffer */
+    char *rio_buf;             /* internal buffer: rio_ibuf or caller's */
+    size_t rio_bufsize;        /* size of rio_buf */
+    char rio_ibuf[RIO_BUFSIZE]; /* default internal buffer */
 } rio_t;
 /* $end rio_t */
 
+/* Buffered output channel, the write-side counterpart of rio_t */
+#define RIO_WBUFSIZE 8192
+typedef struct {
+    int rio_fd;                /* descriptor being written */
+    int rio_notsock;           /* rio_fd is not a socket: no MSG_MORE */
+    size_t rio_wcnt;           /* bytes waiting in rio_wbuf */
+    char rio_wbuf[RIO_WBUFSIZE]; /* output buffer */
+} rio_writer_t;
+
 /* External variables */
 extern int h_errno;    /* defined by BIND for DNS errors */ 
 extern char **environ; /* defined by libc */
@@ -146,8 +162,17 @@ void V(sem_t *sem);
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
 void rio_readinitb(rio_t *rp, int fd); 
+void rio_setbuf(rio_t *rp, char *buf, size_t size);
 ssize_t	rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t	rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t	rio_readline(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t	rio_getline(rio_t *rp, char **linep);
+void rio_settimeout(rio_t *rp, int timeout_ms);
+void rio_writerinit(rio_writer_t *wp, int fd);
+ssize_t rio_writeb(rio_writer_t *wp, void *usrbuf, size_t n);
+ssize_t rio_printfb(rio_writer_t *wp, const char *fmt, ...);
+ssize_t rio_flushb(rio_writer_t *wp, int more);
+int rio_cork(int fd, int on);
 
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
@@ -156,10 +181,31 @@ void Rio_readinitb(rio_t *rp, int fd);
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
 
+/* Non-exiting wrappers for server code paths (see csapp.c) */
+int last_error(void);
+const char *last_error_op(void);
+pid_t Fork_r(void);
+int Close_r(int fd);
+void *Malloc_r(size_t size);
+void *Calloc_r(size_t nmemb, size_t size);
+void *Realloc_r(void *ptr, size_t size);
+int Accept_r(int s, struct sockaddr *addr, socklen_t *addrlen);
+ssize_t Rio_readn_r(int fd, void *usrbuf, size_t n);
+ssize_t Rio_writen_r(int fd, void *usrbuf, size_t n);
+ssize_t Rio_readnb_r(rio_t *rp, void *usrbuf, size_t n);
+ssize_t Rio_readlineb_r(rio_t *rp, void *usrbuf, size_t maxlen);
+
 /* Client/server helper functions */
+#define HE_STAGGER_MS 250 /* delay between Happy Eyeballs attempts */
+#define HE_MAXADDRS   16  /* addresses raced by open_clientfd_he */
 int open_clientfd(char *hostname, int portno);
 int open_clientfd_r(char *hostname, int portno);
 int open_listenfd(int portno);
+int open_clientfd_start(const struct addrinfo *ai);
+int open_clientfd_finish(int clientfd, int timeout_ms);
+int open_clientfd_timeout(const struct addrinfo *ai, int timeout_ms);
+int open_clientfd_he(struct addrinfo *addrs, int stagger_ms, int timeout_ms,
+		     struct addrinfo **used);
 
 /* Wrappers for client/server helper functions */
 int Open_clientfd(char *hostname, int port);
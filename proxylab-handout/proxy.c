@@ -17,12 +17,31 @@ static const char *accept_hdr = "Accept: text/html,application/xhtml+xml,\
  application/xml;q=0.9,*/*;q=0.8\r\n";
 static const char *accept_encoding_hdr = "Accept-Encoding: gzip, deflate\r\n";
 
+/*
+ * Deadlines (ms) for talking to the origin server, so one hung origin
+ * cannot pin a thread forever
+ */
+#define CONNECT_TIMEOUT_MS    3000  /* connect(), all addresses together */
+#define FIRST_BYTE_TIMEOUT_MS 10000 /* request sent -> first response byte */
+#define IDLE_TIMEOUT_MS       5000  /* gap between two response chunks */
+
+/*
+ * Hedging: if the first byte is later than the observed p95, the request
+ * is sent again to the next resolved address and the faster answer wins
+ */
+#define HEDGE_DEFAULT_MS      200   /* delay used until we have samples */
+#define HEDGE_MIN_SAMPLES     20
+#define LAT_BUCKETS           16    /* bucket i: [2^i - 1, 2^(i+1) - 1) ms */
+#define LAT_DECAY_AT          1024  /* halve the histogram at this count */
+
 /*
  * Helper Functions
  */
 void get_request_from_client(int client_fd);
 char *parse_uri(char *uri, char *host, char *path, char *cgiargs);
 void prepare_string(char *buf2, char *path, char *host);
+void purge_request(int client_fd, char *key);
+int open_origin(char *host, int port, char *request);
 
 /*
  * Thread function prototype
@@ -32,6 +51,14 @@ void *thread(void *vargp);
 cache_list *cache;
 sem_t mutex;
 
+/* Set by -H: hedge slow origins */
+int hedging = 0;
+
+/* First-byte latency histogram, feeds the hedging delay */
+unsigned int lat_hist[LAT_BUCKETS];
+unsigned int lat_count = 0;
+pthread_mutex_t lat_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Main
  *
@@ -47,16 +74,16 @@ int main(int argc, char** argv)
     pthread_t tid;
 
     /* Initialize the cache */
-    cache = (cache_list*) Malloc(sizeof(cache_list));
-    cache->head = NULL;
-    cache->size = 0;
+    cache = (cache_list*) Calloc(1, sizeof(cache_list));
     init_cache();
 
     clientlen = sizeof(clientaddr);
 
     /* Check the command line arguments */
-    if (argc != 2) {
-	fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+    if (argc == 3 && !strcmp(argv[1], "-H"))
+	hedging = 1;
+    else if (argc != 2) {
+	fprintf(stderr, "Usage: %s [-H] <port>\n", argv[0]);
 	exit(0);
     }
 
@@ -64,19 +91,31 @@ int main(int argc, char** argv)
     Signal(SIGPIPE, SIG_IGN);
 
     /* Get the port number */
-    port = atoi(argv[1]);
+    port = atoi(argv[argc - 1]);
 
     Sem_init(&mutex, 0, 1);
     /* Here it listens for connections until there is a connection */
     listenfd = Open_listenfd(port);
     while(1) {
-	if ((connfdp = Malloc(sizeof(int))) == NULL) {
-	    printf("Malloc error !!\n");
+	if ((connfdp = Malloc_r(sizeof(int))) == NULL) {
+	    printf("Malloc error: %s\n", strerror(last_error()));
+	    sleep(1);
+	    continue;
 	}
 	P(&mutex);
 	/* The connfd accepts the connection from the client and get its address*/
-	*connfdp = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-	Pthread_create(&tid, NULL, thread, connfdp);
+	if ((*connfdp = Accept_r(listenfd, (SA *)&clientaddr, &clientlen)) < 0) {
+	    printf("Accept error: %s\n", strerror(last_error()));
+	    V(&mutex);
+	    Free(connfdp);
+	    continue;
+	}
+	if (pthread_create(&tid, NULL, thread, connfdp) != 0) {
+	    printf("Pthread_create error, dropping connection\n");
+	    Close_r(*connfdp);
+	    V(&mutex);
+	    Free(connfdp);
+	}
     }
 
     /* The program should not reach here */
@@ -95,7 +134,7 @@ void *thread(void *vargp)
     V(&mutex);
     Pthread_detach(pthread_self());
     get_request_from_client(connfd);
-    Close(connfd);
+    Close_r(connfd);
     return NULL;
 } 
 
@@ -109,26 +148,32 @@ void get_request_from_client(int client_fd)
     char buf2[MAX_OBJECT_SIZE];
     rio_t rio_c, rio_s;
     int port, proxyfd;
-    size_t rec_count;
+    ssize_t rec_count;
     char host[MAXLINE], path[MAXLINE], cgiargs[MAXLINE]; 
+    char key[MAXLINE];
 
     char temp_cache[MAX_OBJECT_SIZE];
     unsigned int temp_size = 0;
+    int cached;
 
     Rio_readinitb(&rio_c, client_fd);
-    Rio_readlineb(&rio_c, buf, MAXLINE);
+    if (Rio_readlineb_r(&rio_c, buf, MAXLINE) <= 0)
+        return; /* client went away: only this connection is lost */
     sscanf(buf, "%s %s %s", method, uri, version);
 
     port = atoi(parse_uri(uri, host, path, cgiargs));
-    strcat(uri, path);
-    printf("uri: %s", uri);
+    normalize_key(key, host, port, path);
+    printf("key: %s\n", key);
 
-    cache_node *match_node = search(cache, uri);
+    if (!strcasecmp(method, "PURGE")) {
+        purge_request(client_fd, key);
+        return;
+    }
 
-    /* if data in the cache, send as a response*/
-    if (match_node != NULL) {
+    /* if data in the cache, send our copy of it as a response */
+    if ((cached = search(cache, key, temp_cache)) >= 0) {
         printf("Reading from the cache\n");
-        if (rio_writen(client_fd, match_node->content, match_node->size) < 0) {
+        if (rio_writen(client_fd, temp_cache, cached) < 0) {
             printf("Error while sending the response to client\n");
         }
     }
@@ -137,42 +182,69 @@ void get_request_from_client(int client_fd)
     prepare_string(buf2, path, host);
     printf("the string sent to the server is %s \n", buf2);
     printf("string length is %lu\n", strlen(buf2));
-    /* Reentrant open client fd function */
-    proxyfd = Open_clientfd_r(host, port);
-       if (proxyfd < 0)
-    {
-        if (proxyfd != -1) {
-return;        
-}
+    /* Connect, send and wait for the first byte, all under deadlines */
+    proxyfd = open_origin(host, port, buf2);
+    if (proxyfd < 0) {
+        printf("Origin %s:%d failed: %s\n", host, port, strerror(errno));
         return;
     }
 
     Rio_readinitb(&rio_s, proxyfd);
+    /* The first byte is waiting; from here on only idle gaps are bounded */
+    rio_settimeout(&rio_s, IDLE_TIMEOUT_MS);
 
-    Rio_writen(proxyfd, buf2, strlen(buf2));
-    
     memset(buf2, 0, MAX_OBJECT_SIZE); 
     memset(temp_cache, 0, MAX_OBJECT_SIZE); 
-    while ((rec_count = Rio_readnb(&rio_s, buf2, MAX_OBJECT_SIZE)) >= 0) {
+    while ((rec_count = rio_readnb(&rio_s, buf2, MAX_OBJECT_SIZE)) > 0) {
+	if (temp_size + rec_count <= MAX_OBJECT_SIZE) {
+	    memcpy(temp_cache + temp_size, buf2, rec_count);
+	}
 	temp_size = temp_size + rec_count;
-	if (temp_size < MAX_OBJECT_SIZE) {
-	    //strcat(temp_cache, buf2);
-	    memcpy(temp_cache, buf2, rec_count);
+	if (rio_writen(client_fd, buf2, rec_count) < 0) {
+	    rec_count = -1;
+	    break;
 	}
-	Rio_writen(client_fd, buf2, rec_count);	
-	//temp_size = temp_size + rec_count;
-	memset(buf2, 0, MAX_OBJECT_SIZE); 
-	printf("%s\n", buf2);
+    }
+    Close_r(proxyfd);
+    if (rec_count < 0) {
+        printf("Origin %s:%d aborted: %s\n", host, port, strerror(errno));
+        return;
     }
     if (temp_size < MAX_OBJECT_SIZE) {
         printf("Adding data to the cache\n");
-        add_node(cache, uri, temp_cache, temp_size);
+        add_node(cache, key, temp_cache, temp_size);
     }
     }
-    //Close(proxyfd);
     return;
 }
 
+/*
+ * PURGE <url>: drop every cached object whose key starts with the
+ * normalized url. Only accepted from the local host.
+ */
+void purge_request(int client_fd, char *key)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    char buf[MAXLINE];
+    int purged;
+
+    if (getpeername(client_fd, (SA *)&addr, &len) < 0 ||
+        addr.sin_family != AF_INET ||
+        ntohl(addr.sin_addr.s_addr) >> 24 != 127) {
+        sprintf(buf, "HTTP/1.0 403 Forbidden\r\n"
+                "Content-length: 0\r\n\r\n");
+        rio_writen(client_fd, buf, strlen(buf));
+        return;
+    }
+
+    purged = purge_prefix(cache, key);
+    printf("Purged %d objects under %s\n", purged, key);
+    sprintf(buf, "HTTP/1.0 200 OK\r\nContent-length: %d\r\n\r\n%d\n",
+            (int)snprintf(NULL, 0, "%d\n", purged), purged);
+    rio_writen(client_fd, buf, strlen(buf));
+}
+
 /* 
  * String to be sent to the server
  */
@@ -193,6 +265,192 @@ void prepare_string(char *buf2, char *path, char *host)
     return;
 }
 
+/*
+ * now_ms - monotonic clock in milliseconds
+ */
+static long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * record_first_byte - add one first-byte latency to the histogram
+ */
+static void record_first_byte(long ms)
+{
+    int i = 0, j;
+
+    while (i < LAT_BUCKETS - 1 && ms + 1 >= (2L << i))
+	i++;
+    pthread_mutex_lock(&lat_lock);
+    if (++lat_count >= LAT_DECAY_AT) {
+	/* Age old samples so the estimate follows the origins */
+	lat_count = 0;
+	for (j = 0; j < LAT_BUCKETS; j++) {
+	    lat_hist[j] /= 2;
+	    lat_count += lat_hist[j];
+	}
+    }
+    lat_hist[i]++;
+    pthread_mutex_unlock(&lat_lock);
+}
+
+/*
+ * first_byte_p95 - upper bound of the bucket holding the 95th
+ * percentile first-byte latency, used as the hedging delay
+ */
+static int first_byte_p95(void)
+{
+    unsigned int seen = 0, total;
+    int i, ms = HEDGE_DEFAULT_MS;
+
+    pthread_mutex_lock(&lat_lock);
+    for (i = 0, total = 0; i < LAT_BUCKETS; i++)
+	total += lat_hist[i];
+    if (total >= HEDGE_MIN_SAMPLES) {
+	for (i = 0; i < LAT_BUCKETS; i++) {
+	    seen += lat_hist[i];
+	    if (seen * 100 >= total * 95)
+		break;
+	}
+	ms = (2 << i) - 1;
+    }
+    pthread_mutex_unlock(&lat_lock);
+    return ms;
+}
+
+/*
+ * open_origin - Connect to the origin, send the request and wait until
+ * the first response byte is readable. Each phase has its own deadline.
+ * With hedging on, a second copy of the request goes to the next
+ * resolved address once the p95 first-byte time has passed, and whichever
+ * connection answers first is kept; one that fails or closes first just
+ * drops out of the race. Returns that descriptor, or -1 with errno set
+ * (ETIMEDOUT when a deadline expired, ECONNRESET when every attempt
+ * failed).
+ */
+int open_origin(char *host, int port, char *request)
+{
+    struct addrinfo hints, *addrs, *p, *hedge_ai;
+    struct pollfd pfds[2];
+    char port_str[16], c;
+    int fds[2] = {-1, -1};
+    int nfds = 0, hedge_connecting = 0, winner = -1, failed = 0;
+    int i, rc, wait, hedge_ms = -1;
+    long start, elapsed;
+    size_t len = strlen(request);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;  /* IPv6 and IPv4, raced below */
+    hints.ai_socktype = SOCK_STREAM;
+    sprintf(port_str, "%d", port);
+    if ((rc = getaddrinfo(host, port_str, &hints, &addrs)) != 0) {
+	errno = (rc == EAI_SYSTEM) ? errno : EHOSTUNREACH;
+	return -1;
+    }
+
+    /* Primary: Happy Eyeballs over all the addresses, one deadline */
+    if ((fds[0] = open_clientfd_he(addrs, HE_STAGGER_MS, CONNECT_TIMEOUT_MS,
+				   &p)) < 0) {
+	freeaddrinfo(addrs);
+	return -1;
+    }
+    if (rio_writen(fds[0], request, len) != len) {
+	close(fds[0]);
+	freeaddrinfo(addrs);
+	return -1;
+    }
+    nfds = 1;
+    /* The hedge goes to some other address than the one that answered */
+    hedge_ai = p->ai_next ? p->ai_next : (p != addrs ? addrs : NULL);
+    if (hedging && hedge_ai)
+	hedge_ms = first_byte_p95();
+    start = now_ms();
+
+    while ((elapsed = now_ms() - start) < FIRST_BYTE_TIMEOUT_MS) {
+	wait = FIRST_BYTE_TIMEOUT_MS - elapsed;
+	if (hedge_ms >= 0) {
+	    if (elapsed >= hedge_ms) {
+		/* Primary is late: race it against the next address */
+		hedge_ms = -1;
+		if ((fds[1] = open_clientfd_start(hedge_ai)) >= 0) {
+		    nfds = 2;
+		    hedge_connecting = 1;
+		}
+		continue;
+	    }
+	    if (hedge_ms - elapsed < wait)
+		wait = hedge_ms - elapsed;
+	}
+	/* Both attempts failed, and no hedge is left to send */
+	if (fds[0] < 0 && (nfds < 2 || fds[1] < 0)) {
+	    failed = 1;
+	    break;
+	}
+
+	/* poll skips a negative fd, i.e. an attempt that failed */
+	for (i = 0; i < nfds; i++) {
+	    pfds[i].fd = fds[i];
+	    pfds[i].events = POLLIN;
+	    pfds[i].revents = 0;
+	}
+	if (hedge_connecting)
+	    pfds[1].events = POLLOUT;
+	if ((rc = poll(pfds, nfds, wait)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	if (rc == 0)
+	    continue;
+
+	if (nfds == 2 && hedge_connecting && pfds[1].revents) {
+	    /* Hedge connected (or failed): send it the same request */
+	    hedge_connecting = 0;
+	    pfds[1].revents = 0;
+	    if (open_clientfd_finish(fds[1], 0) < 0) {
+		fds[1] = -1;
+	    } else if (rio_writen(fds[1], request, len) != len) {
+		close(fds[1]);
+		fds[1] = -1;
+	    }
+	}
+	for (i = 0; i < nfds; i++) {
+	    if (pfds[i].revents == 0 || fds[i] < 0)
+		continue;
+	    /* Only a response byte wins; EOF or an error fails this attempt */
+	    if ((rc = recv(fds[i], &c, 1, MSG_PEEK | MSG_DONTWAIT)) == 1) {
+		winner = i;
+		break;
+	    }
+	    if (rc < 0 && (errno == EAGAIN || errno == EINTR))
+		continue;
+	    close(fds[i]);
+	    fds[i] = -1;
+	    /* The primary is gone: send the hedge now rather than later */
+	    if (i == 0 && hedge_ms >= 0)
+		hedge_ms = 0;
+	}
+	if (winner >= 0)
+	    break;
+    }
+    freeaddrinfo(addrs);
+
+    for (i = 0; i < nfds; i++) {
+	if (i != winner && fds[i] >= 0)
+	    close(fds[i]);
+    }
+    if (winner < 0) {
+	errno = failed ? ECONNRESET : ETIMEDOUT;
+	return -1;
+    }
+    record_first_byte(now_ms() - start);
+    return fds[winner];
+}
+
 /*
  * parse uri function
  */
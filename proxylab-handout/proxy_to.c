@@ -334,41 +334,24 @@ int forward_request_response(int fd, char *uri, char *host, char *port, \
 }
 
 /*
- * open_clientfd_r - thread-safe version of open_clientfd
+ * open_clientfd_r - thread-safe version of open_clientfd; races the
+ * IPv6 and IPv4 addresses of hostname (see open_clientfd_he)
  */
 int open_clientfd_r(char *hostname, char *port) {
+    struct addrinfo hints, *addlist;
     int clientfd;
-    struct addrinfo *addlist, *p;
-    int rv;
 
-    /* Create the socket descriptor */
-    if ((clientfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    /* Get a list of addrinfo structs, of any address family */
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(hostname, port, &hints, &addlist) != 0) {
         return -1;
     }
 
-    /* Get a list of addrinfo structs */
-    if ((rv = getaddrinfo(hostname, port, NULL, &addlist)) != 0) {
-        return -1;
-    }
-  
-    /* Walk the list, using each addrinfo to try to connect */
-    for (p = addlist; p; p = p->ai_next) {
-        if ((p->ai_family == AF_INET)) {
-            if (connect(clientfd, p->ai_addr, p->ai_addrlen) == 0) {
-                break; /* success */
-            }
-        }
-    } 
-
-    /* Clean up */
+    clientfd = open_clientfd_he(addlist, HE_STAGGER_MS, 0, NULL);
     freeaddrinfo(addlist);
-    if (!p) { /* all connects failed */
-        close(clientfd);
-        return -1;
-    }
-    else { /* one of the connects succeeded */
-        return clientfd;
-    }
+    return clientfd;
 }
 
 int main(int argc, char **argv)
@@ -0,0 +1,487 @@
+/*
+ * assets.c - in-memory static asset store for tiny.
+ *
+ * At startup, and again on every SIGHUP, the document root is read into
+ * an immutable table: for each file its body, a gzip copy when that is
+ * smaller, an ETag and fully rendered 200/304 headers. Requests look
+ * files up with a minimal perfect hash and never touch the disk. A
+ * reload builds a new table and swaps it in; the old one is freed when
+ * the last request using it is done.
+ */
+#include <dirent.h>
+#include <zlib.h>
+#include "assets.h"
+
+static asset_table *current = NULL;
+static char *docroot = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* MIME types by file extension */
+static struct {
+    char *ext;
+    char *type;
+} mime_types[] = {
+    { ".html", "text/html" },
+    { ".htm",  "text/html" },
+    { ".gif",  "image/gif" },
+    { ".jpg",  "image/jpeg" },
+    { ".jpeg", "image/jpeg" },
+    { ".png",  "image/png" },
+    { ".css",  "text/css" },
+    { ".js",   "application/javascript" },
+    { NULL,    NULL }
+};
+
+/* known_type - the MIME type of filename's extension, or NULL */
+static char *known_type(char *filename)
+{
+    char *ext = strrchr(filename, '.');
+    int i;
+
+    if (ext && !strchr(ext, '/')) {
+	for (i = 0; mime_types[i].ext; i++) {
+	    if (!strcasecmp(ext, mime_types[i].ext))
+		return mime_types[i].type;
+	}
+    }
+    return NULL;
+}
+
+/*
+ * get_filetype - derive file type from the file name's extension
+ */
+void get_filetype(char *filename, char *filetype)
+{
+    char *type = known_type(filename);
+
+    strcpy(filetype, type ? type : "text/plain");
+}
+
+/* Seeded FNV-1a hash */
+static unsigned int fnv(unsigned int seed, char *s)
+{
+    unsigned int h = 2166136261u ^ seed;
+
+    while (*s) {
+	h ^= (unsigned char)*s++;
+	h *= 16777619u;
+    }
+    return h;
+}
+
+/* gzip n bytes of in; returns NULL unless it saves at least 10% */
+static char *gzip(char *in, size_t n, size_t *outn)
+{
+    z_stream zs;
+    char *out;
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+		     Z_DEFAULT_STRATEGY) != Z_OK)
+	return NULL;
+    if ((out = Malloc_r(deflateBound(&zs, n))) == NULL) {
+	deflateEnd(&zs);
+	return NULL;
+    }
+    zs.next_in = (unsigned char *)in;
+    zs.avail_in = n;
+    zs.next_out = (unsigned char *)out;
+    zs.avail_out = deflateBound(&zs, n);
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END ||
+	zs.total_out >= n - n / 10) {
+	deflateEnd(&zs);
+	Free(out);
+	return NULL;
+    }
+    *outn = zs.total_out;
+    deflateEnd(&zs);
+    return out;
+}
+
+/*
+ * load_file - read filename into a and render its responses; -1 if it
+ * can't be read or its headers don't fit in MAXBUF
+ */
+static int load_file(asset *a, char *filename, size_t size)
+{
+    char *filetype = known_type(filename);
+    char hdr[MAXBUF], gzhdr[MAXBUF], hdr304[MAXBUF];
+    unsigned long long h = 14695981039346656037ull;
+    size_t i;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY, 0)) < 0)
+	return -1;
+    if ((a->body = Malloc_r(size ? size : 1)) == NULL) {
+	close(fd);
+	return -1;
+    }
+    if (rio_readn(fd, a->body, size) != (ssize_t)size) {
+	close(fd);
+	Free(a->body);
+	return -1;
+    }
+    close(fd);
+    a->size = size;
+    a->gzbody = gzip(a->body, size, &a->gzsize);
+
+    /* ETag: 64-bit FNV-1a of the content */
+    for (i = 0; i < size; i++) {
+	h ^= (unsigned char)a->body[i];
+	h *= 1099511628211ull;
+    }
+    sprintf(a->etag, "\"%016llx\"", h);
+
+    if (snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\n"
+		 "Server: Tiny Web Server\r\n"
+		 "Content-length: %zu\r\n"
+		 "Content-type: %s\r\n"
+		 "ETag: %s\r\n%s\r\n", size, filetype, a->etag,
+		 a->gzbody ? "Vary: Accept-Encoding\r\n" : "") >=
+	(int)sizeof(hdr) ||
+	(a->gzbody &&
+	 snprintf(gzhdr, sizeof(gzhdr), "HTTP/1.0 200 OK\r\n"
+		  "Server: Tiny Web Server\r\n"
+		  "Content-length: %zu\r\n"
+		  "Content-type: %s\r\n"
+		  "Content-encoding: gzip\r\n"
+		  "ETag: %s\r\n"
+		  "Vary: Accept-Encoding\r\n\r\n", a->gzsize, filetype,
+		  a->etag) >= (int)sizeof(gzhdr)) ||
+	snprintf(hdr304, sizeof(hdr304), "HTTP/1.0 304 Not Modified\r\n"
+		 "Server: Tiny Web Server\r\n"
+		 "ETag: %s\r\n\r\n", a->etag) >= (int)sizeof(hdr304)) {
+	Free(a->body);
+	if (a->gzbody)
+	    Free(a->gzbody);
+	return -1;
+    }
+    a->filename = strdup(filename);
+    a->hdr = strdup(hdr);
+    a->gzhdr = a->gzbody ? strdup(gzhdr) : NULL;
+    a->hdr304 = strdup(hdr304);
+    return 0;
+}
+
+/*
+ * scan - load every readable regular file under dir with a known
+ * content type into the growing array *list. Hidden entries, cgi-bin
+ * and symbolic links are skipped, so the scan stays in the document
+ * tree and leaves sources, objects and binaries alone.
+ */
+static void scan(char *dir, asset **list, int *n, int *cap, size_t *total)
+{
+    char path[MAXLINE];
+    struct dirent *de;
+    struct stat sbuf;
+    DIR *dp;
+
+    if ((dp = opendir(dir)) == NULL)
+	return;
+    while ((de = readdir(dp)) != NULL) {
+	if (de->d_name[0] == '.' || !strcmp(de->d_name, "cgi-bin"))
+	    continue;
+	snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+	if (lstat(path, &sbuf) < 0)
+	    continue;
+	if (S_ISDIR(sbuf.st_mode)) {
+	    scan(path, list, n, cap, total);
+	    continue;
+	}
+	if (!S_ISREG(sbuf.st_mode) || !(S_IRUSR & sbuf.st_mode) ||
+	    known_type(path) == NULL || sbuf.st_size > ASSET_MAXSIZE ||
+	    *total + sbuf.st_size > ASSET_MAXTOTAL)
+	    continue;
+	if (*n == *cap) {
+	    *cap = *cap ? 2 * *cap : 64;
+	    *list = Realloc(*list, *cap * sizeof(asset));
+	}
+	if (load_file(&(*list)[*n], path, sbuf.st_size) == 0) {
+	    *total += sbuf.st_size;
+	    (*n)++;
+	}
+    }
+    closedir(dp);
+}
+
+/*
+ * build - place the n assets of list into a minimal perfect hash
+ * (hash and displace): each bucket of fnv(0, name) gets the first seed
+ * that sends all of its names to distinct free slots. Singletons just
+ * take a free slot, recorded as -(slot + 1). Returns NULL if some bucket
+ * can't be placed with any of the first ASSET_MAXSEED seeds; the assets
+ * then still belong to list.
+ */
+static asset_table *build(asset *list, int n)
+{
+    asset_table *t = Calloc(1, sizeof(asset_table));
+    int *bucket, *bucket_size, *pos, *order, *used, *try;
+    int i, j, k, b, d, nb, free_slot = 0;
+
+    t->n = n;
+    t->refcnt = 1;
+    if (n == 0)
+	return t;
+    t->disp = Calloc(n, sizeof(int));
+    t->slots = Calloc(n, sizeof(asset));
+    bucket = Malloc(n * sizeof(int));
+    order = Malloc(n * sizeof(int));
+    used = Calloc(n, sizeof(int));
+    try = Malloc(n * sizeof(int));
+    bucket_size = Calloc(n, sizeof(int));
+    pos = Calloc(n + 1, sizeof(int));
+
+    for (i = 0; i < n; i++) {
+	bucket[i] = fnv(0, list[i].filename) % n;
+	bucket_size[bucket[i]]++;
+    }
+
+    /* Biggest buckets first: a counting sort on bucket size */
+    for (b = 0; b < n; b++)
+	pos[bucket_size[b]]++;
+    for (d = n, k = 0; d >= 0; d--) {
+	nb = pos[d];
+	pos[d] = k;
+	k += nb;
+    }
+    for (b = 0; b < n; b++)
+	order[pos[bucket_size[b]]++] = b;
+    Free(pos);
+
+    for (k = 0; k < n && bucket_size[order[k]] > 0; k++) {
+	b = order[k];
+	if (bucket_size[b] == 1) {
+	    for (i = 0; bucket[i] != b; i++)
+		;
+	    while (used[free_slot])
+		free_slot++;
+	    t->disp[b] = -free_slot - 1;
+	    used[free_slot] = 1;
+	    t->slots[free_slot] = list[i];
+	    continue;
+	}
+	for (d = 1; d <= ASSET_MAXSEED; d++) {
+	    for (i = 0, nb = 0; i < n; i++) {
+		if (bucket[i] != b)
+		    continue;
+		try[nb] = fnv(d, list[i].filename) % n;
+		if (used[try[nb]])
+		    break;
+		for (j = 0; j < nb && try[j] != try[nb]; j++)
+		    ;
+		if (j < nb)
+		    break;
+		nb++;
+	    }
+	    if (i == n)
+		break;
+	}
+	if (d > ASSET_MAXSEED) {
+	    /* No seed places this bucket: give up on the whole table */
+	    Free(t->disp);
+	    Free(t->slots);
+	    Free(t);
+	    t = NULL;
+	    break;
+	}
+	t->disp[b] = d;
+	for (i = 0, nb = 0; i < n; i++) {
+	    if (bucket[i] == b) {
+		used[try[nb]] = 1;
+		t->slots[try[nb++]] = list[i];
+	    }
+	}
+    }
+
+    Free(bucket);
+    Free(order);
+    Free(used);
+    Free(try);
+    Free(bucket_size);
+    return t;
+}
+
+/* free_assets - release the contents of the n assets in a */
+static void free_assets(asset *a, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+	Free(a[i].filename);
+	Free(a[i].body);
+	Free(a[i].hdr);
+	Free(a[i].hdr304);
+	if (a[i].gzbody) {
+	    Free(a[i].gzbody);
+	    Free(a[i].gzhdr);
+	}
+    }
+}
+
+/* free_table - release a table nobody references any more */
+static void free_table(asset_table *t)
+{
+    free_assets(t->slots, t->n);
+    if (t->n) {
+	Free(t->disp);
+	Free(t->slots);
+    }
+    Free(t);
+}
+
+/*
+ * assets_reload - load a fresh snapshot of the document root and make
+ * it current. If it can't be hashed, the old snapshot stays current (at
+ * startup, an empty one, so everything is served from disk).
+ */
+void assets_reload(void)
+{
+    asset *list = NULL;
+    int n = 0, cap = 0;
+    size_t total = 0;
+    asset_table *t, *old;
+
+    scan(docroot, &list, &n, &cap, &total);
+    if ((t = build(list, n)) == NULL) {
+	fprintf(stderr, "Could not hash %d static assets, not reloaded\n", n);
+	free_assets(list, n);
+	Free(list);
+	if (current != NULL) /* only written here, by one thread at a time */
+	    return;
+	t = build(NULL, 0);
+	n = 0;
+	total = 0;
+    } else if (list) {
+	Free(list);
+    }
+
+    pthread_mutex_lock(&lock);
+    old = current;
+    current = t;
+    pthread_mutex_unlock(&lock);
+    if (old)
+	assets_put(old);
+    printf("Loaded %d static assets (%zu bytes)\n", n, total);
+}
+
+/* reloader - thread that reloads the assets on each SIGHUP */
+static void *reloader(void *vargp)
+{
+    sigset_t set;
+    int sig;
+
+    Pthread_detach(pthread_self());
+    Sigemptyset(&set);
+    Sigaddset(&set, SIGHUP);
+    while (1) {
+	if (sigwait(&set, &sig) == 0)
+	    assets_reload();
+    }
+    return NULL;
+}
+
+/*
+ * assets_init - load the assets under root. Call before any other
+ * thread is created: SIGHUP is blocked here, so that every thread
+ * inherits the mask and only the reloader thread receives it.
+ */
+void assets_init(char *root)
+{
+    sigset_t set;
+    pthread_t tid;
+
+    docroot = strdup(root);
+    assets_reload();
+    Sigemptyset(&set);
+    Sigaddset(&set, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    Pthread_create(&tid, NULL, reloader, NULL);
+}
+
+/* assets_get - reference the current table */
+asset_table *assets_get(void)
+{
+    asset_table *t;
+
+    pthread_mutex_lock(&lock);
+    t = current;
+    t->refcnt++;
+    pthread_mutex_unlock(&lock);
+    return t;
+}
+
+/* assets_put - drop a reference from assets_get */
+void assets_put(asset_table *t)
+{
+    int last;
+
+    pthread_mutex_lock(&lock);
+    last = (--t->refcnt == 0);
+    pthread_mutex_unlock(&lock);
+    if (last)
+	free_table(t);
+}
+
+/* assets_find - the asset for filename in t, or NULL */
+asset *assets_find(asset_table *t, char *filename)
+{
+    asset *a;
+    int d;
+
+    if (t->n == 0)
+	return NULL;
+    d = t->disp[fnv(0, filename) % t->n];
+    a = &t->slots[d < 0 ? -d - 1 : fnv(d, filename) % t->n];
+    return strcmp(a->filename, filename) ? NULL : a;
+}
+
+/* skip_ws - skip spaces and tabs */
+static char *skip_ws(char *p)
+{
+    while (*p == ' ' || *p == '\t')
+	p++;
+    return p;
+}
+
+/*
+ * accepts_gzip - whether an Accept-Encoding value allows gzip: the
+ * coding "gzip" (or failing that, "*") is listed with a q above 0.
+ * Other codings that merely contain "gzip", like x-gzip, don't count.
+ */
+int accepts_gzip(char *value)
+{
+    double q, gzip_q = -1, star_q = -1;
+    char *p = value, *tok, *end;
+    size_t len;
+
+    while (*p) {
+	/* The coding token */
+	tok = p = skip_ws(p);
+	while (*p && !strchr(",; \t\r\n", *p))
+	    p++;
+	len = p - tok;
+
+	/* Its parameters; only q matters */
+	q = 1;
+	p = skip_ws(p);
+	while (*p == ';') {
+	    p = skip_ws(p + 1);
+	    if ((*p == 'q' || *p == 'Q') && *(end = skip_ws(p + 1)) == '=') {
+		q = strtod(skip_ws(end + 1), &end);
+		p = end;
+	    }
+	    while (*p && *p != ';' && *p != ',')
+		p++;
+	}
+
+	if (len == 4 && !strncasecmp(tok, "gzip", 4))
+	    gzip_q = q;
+	else if (len == 1 && *tok == '*')
+	    star_q = q;
+	while (*p && *p != ',')
+	    p++;
+	if (*p == ',')
+	    p++;
+    }
+    return gzip_q >= 0 ? gzip_q > 0 : star_q > 0;
+}
@@ -0,0 +1,43 @@
+#ifndef __ASSETS_H__
+#define __ASSETS_H__
+
+#include "csapp.h"
+
+#define ASSET_MAXSIZE  (1<<20)   /* larger files are left to fcache */
+#define ASSET_MAXTOTAL (64<<20)  /* bytes of bodies loaded at most */
+#define ASSET_MAXSEED  (1<<16)   /* seeds tried per bucket by the hash */
+
+/* One static file, with everything needed to answer for it rendered */
+typedef struct asset {
+    char *filename;        /* "./path", as built by parse_uri */
+    char *body;
+    size_t size;
+    char *gzbody;          /* NULL when gzip doesn't pay off */
+    size_t gzsize;
+    char etag[20];         /* quoted 64-bit content hash */
+    char *hdr;             /* 200 headers for the plain body */
+    char *gzhdr;           /* 200 headers for the gzip body */
+    char *hdr304;          /* complete 304 response */
+} asset;
+
+/*
+ * An immutable snapshot of the document root. Lookups use a minimal
+ * perfect hash: the bucket of hash(0, name) gives either the slot
+ * directly (negative disp) or the seed to rehash with.
+ */
+typedef struct asset_table {
+    int n;                 /* number of assets and of slots */
+    int *disp;             /* per-bucket displacement */
+    asset *slots;
+    int refcnt;            /* requests using this snapshot, +1 if current */
+} asset_table;
+
+void assets_init(char *root);
+void assets_reload(void);
+asset_table *assets_get(void);
+asset *assets_find(asset_table *t, char *filename);
+void assets_put(asset_table *t);
+void get_filetype(char *filename, char *filetype);
+int accepts_gzip(char *value);
+
+#endif /* __ASSETS_H__ */
@@ -1,35 +1,63 @@
 /*
  * adder.c - a minimal CGI program that adds two numbers together
+ *
+ * Run by tiny as a persistent worker (see cgiproto.h) it serves request
+ * after request; run any other way it is a classic one-shot CGI program.
  */
 /* $begin adder */
 #include "csapp.h"
+#include "cgiproto.h"
 
-int main(void) {
-    char *buf, *p;
+/* Render the CGI output for query into out; returns its length */
+int adder(char *query, char *out) {
+    char *p;
     char arg1[MAXLINE], arg2[MAXLINE], content[MAXLINE];
-    int n1=0, n2=0;
+    int n1=0, n2=0, len;
 
     /* Extract the two arguments */
-    if ((buf = getenv("QUERY_STRING")) != NULL) {
-	p = strchr(buf, '&');
+    if ((p = strchr(query, '&')) != NULL) {
 	*p = '\0';
-	strcpy(arg1, buf);
+	strcpy(arg1, query);
 	strcpy(arg2, p+1);
 	n1 = atoi(arg1);
 	n2 = atoi(arg2);
     }
 
     /* Make the response body */
-    sprintf(content, "Welcome to add.com: ");
-    sprintf(content, "%sTHE Internet addition portal.\r\n<p>", content);
-    sprintf(content, "%sThe answer is: %d + %d = %d\r\n<p>", 
-	    content, n1, n2, n1 + n2);
-    sprintf(content, "%sThanks for visiting!\r\n", content);
+    len = sprintf(content, "Welcome to add.com: "
+		  "THE Internet addition portal.\r\n<p>"
+		  "The answer is: %d + %d = %d\r\n<p>"
+		  "Thanks for visiting!\r\n", n1, n2, n1 + n2);
   
     /* Generate the HTTP response */
-    printf("Content-length: %d\r\n", (int)strlen(content));
-    printf("Content-type: text/html\r\n\r\n");
-    printf("%s", content);
+    return sprintf(out, "Content-length: %d\r\n"
+		   "Content-type: text/html\r\n\r\n%s", len, content);
+}
+
+int main(void) {
+    char query[MAXLINE], out[2*MAXLINE];
+    char *buf;
+    ssize_t n;
+
+    if (getenv(CGI_WORKER_ENV) != NULL) {
+	/* Persistent worker: one frame in, one frame out, until EOF */
+	if (cgi_write_frame(STDOUT_FILENO, CGI_HELLO, strlen(CGI_HELLO)) < 0)
+	    exit(1);
+	while ((n = cgi_read_frame(STDIN_FILENO, query, MAXLINE-1)) >= 0) {
+	    query[n] = '\0';
+	    if (cgi_write_frame(STDOUT_FILENO, out, adder(query, out)) < 0)
+		exit(1);
+	}
+	exit(0);
+    }
+
+    if ((buf = getenv("QUERY_STRING")) != NULL)
+	strncpy(query, buf, MAXLINE-1);
+    else
+	query[0] = '\0';
+    query[MAXLINE-1] = '\0';
+    adder(query, out);
+    printf("%s", out);
     fflush(stdout);
     exit(0);
 }
@@ -0,0 +1,256 @@
+/*
+ * cgipool.c - persistent CGI workers for tiny.
+ *
+ * Instead of a fork and exec per dynamic request, each CGI program gets
+ * a pool of long-lived worker processes, talked to over Unix sockets
+ * with the framing in cgiproto.h. A worker is started the first time
+ * its slot is needed, by the thread that needs it, so no lock is held
+ * while a program starts up. Programs that don't answer the hello are
+ * marked classic, and tiny keeps running them the old way.
+ */
+#include <poll.h>
+#include <sys/syscall.h>
+#include "cgipool.h"
+#include "cgiproto.h"
+
+#define CGI_NOHELLO -2  /* spawn: the program started but said no hello */
+
+static cgi_pool *pools = NULL;
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* now_ms - milliseconds on the monotonic clock */
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* read_by - read exactly n bytes before deadline; n, or -1 if not */
+static ssize_t read_by(int fd, void *buf, size_t n, long long deadline)
+{
+    struct pollfd pfd;
+    size_t left = n;
+    long long ms;
+    ssize_t rc;
+    char *p = buf;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (left > 0) {
+	if ((ms = deadline - now_ms()) <= 0)
+	    return -1;
+	if ((rc = poll(&pfd, 1, ms)) < 0 && errno == EINTR)
+	    continue;
+	if (rc <= 0)
+	    return -1;
+	if ((rc = read(fd, p, left)) < 0 && errno == EINTR)
+	    continue;
+	if (rc <= 0)
+	    return -1;
+	left -= rc;
+	p += rc;
+    }
+    return n;
+}
+
+/*
+ * read_frame_by - cgi_read_frame, but give up at deadline. Returns the
+ * frame length, or -1 on EOF, error, timeout or an oversized frame.
+ */
+static ssize_t read_frame_by(int fd, void *buf, uint32_t maxlen,
+			     long long deadline)
+{
+    uint32_t len;
+
+    if (read_by(fd, &len, sizeof(len), deadline) != sizeof(len))
+	return -1;
+    if ((len = ntohl(len)) > maxlen)
+	return -1;
+    if (read_by(fd, buf, len, deadline) != (ssize_t)len)
+	return -1;
+    return len;
+}
+
+/*
+ * cgipool_closefds - close every descriptor above stderr. Called in a
+ * child between fork and exec, so a CGI program holds no listening
+ * socket, inotify descriptor or other client's connection of ours.
+ */
+void cgipool_closefds(void)
+{
+    int fd, max;
+
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, STDERR_FILENO + 1, ~0U, 0) == 0)
+	return;
+#endif
+    max = sysconf(_SC_OPEN_MAX);
+    for (fd = STDERR_FILENO + 1; fd < max; fd++)
+	close(fd);
+}
+
+/* reap - stop worker slot i of pool and mark the slot dead */
+static void reap(cgi_pool *pool, int i)
+{
+    if (pool->fds[i] >= 0)
+	close(pool->fds[i]);
+    if (pool->pids[i] > 0) {
+	kill(pool->pids[i], SIGKILL);
+	waitpid(pool->pids[i], NULL, 0);
+    }
+    pool->fds[i] = -1;
+    pool->pids[i] = -1;
+}
+
+/*
+ * spawn - start worker slot i of pool. Returns 0 once the worker has
+ * said hello, CGI_NOHELLO if the program started but didn't say it, or
+ * -1 if there were no resources (memory, descriptors, processes) to
+ * start it.
+ */
+static int spawn(cgi_pool *pool, int i)
+{
+    static char worker_env[] = CGI_WORKER_ENV "=1";
+    char *argv[] = { pool->filename, NULL }, **envp, hello[16];
+    int sv[2], n;
+
+    /* Build the environment before fork: the child must not allocate */
+    for (n = 0; environ[n]; n++)
+	;
+    if ((envp = Malloc_r((n + 2) * sizeof(char *))) == NULL)
+	return -1;
+    memcpy(envp, environ, n * sizeof(char *));
+    envp[n] = worker_env;
+    envp[n + 1] = NULL;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+	Free(envp);
+	return -1;
+    }
+    if ((pool->pids[i] = fork()) == 0) { /* child */
+	dup2(sv[1], STDIN_FILENO);
+	dup2(sv[1], STDOUT_FILENO);
+	cgipool_closefds();
+	execve(pool->filename, argv, envp);
+	_exit(1);
+    }
+    Free(envp);
+    close(sv[1]);
+    pool->fds[i] = sv[0];
+    if (pool->pids[i] < 0) {
+	reap(pool, i);
+	return -1;
+    }
+
+    if ((n = read_frame_by(sv[0], hello, sizeof(hello),
+			   now_ms() + CGI_HELLO_MS)) ==
+	(int)strlen(CGI_HELLO) && !memcmp(hello, CGI_HELLO, n))
+	return 0;
+    reap(pool, i);
+    return CGI_NOHELLO;
+}
+
+/*
+ * get_pool - find the pool for filename, adding an empty one if needed;
+ * NULL if there is no memory for a new one
+ */
+static cgi_pool *get_pool(char *filename)
+{
+    cgi_pool *pool;
+    int i;
+
+    pthread_mutex_lock(&pools_lock);
+    for (pool = pools; pool; pool = pool->next) {
+	if (!strcmp(pool->filename, filename))
+	    break;
+    }
+    if (pool == NULL) {
+	if ((pool = Calloc_r(1, sizeof(cgi_pool))) == NULL ||
+	    (pool->filename = strdup(filename)) == NULL) {
+	    pthread_mutex_unlock(&pools_lock);
+	    Free(pool);
+	    return NULL; /* run it the classic way this time */
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	for (i = 0; i < CGI_WORKERS; i++) {
+	    pool->fds[i] = -1; /* started when first used */
+	    pool->pids[i] = -1;
+	    pool->idle[pool->nidle++] = i;
+	}
+	Sem_init(&pool->avail, 0, pool->nidle);
+	pool->next = pools;
+	pools = pool;
+    }
+    pthread_mutex_unlock(&pools_lock);
+    return pool;
+}
+
+/*
+ * cgipool_run - run filename with cgiargs on a persistent worker and
+ * put its CGI output (headers and body) in out. Returns the output
+ * length; CGI_CLASSIC if the program must be run the classic way; or
+ * CGI_FAILED if a worker took the request but didn't answer it within
+ * CGI_RUN_MS with at most maxlen bytes, or if no worker could be started
+ * for lack of resources. The program must not be run again for a failed
+ * request.
+ */
+ssize_t cgipool_run(char *filename, char *cgiargs, char *out, size_t maxlen)
+{
+    cgi_pool *pool = get_pool(filename);
+    ssize_t n = CGI_FAILED;
+    int i, rc, tries, classic;
+
+    if (pool == NULL)
+	return CGI_CLASSIC;
+    pthread_mutex_lock(&pool->lock);
+    classic = pool->classic;
+    pthread_mutex_unlock(&pool->lock);
+    if (classic)
+	return CGI_CLASSIC;
+
+    P(&pool->avail);
+    pthread_mutex_lock(&pool->lock);
+    i = pool->idle[--pool->nidle];
+    pthread_mutex_unlock(&pool->lock);
+
+    /*
+     * The slot is ours now. It is started if it never was, and a worker
+     * that died since its last request is replaced once: a write that
+     * fails was never seen by the program. Once the request is written,
+     * any failure is final. Only a program that never said hello is
+     * demoted to classic; running short of processes or descriptors
+     * just fails this request.
+     */
+    for (tries = 0; tries < 2; tries++) {
+	if (pool->fds[i] < 0 && (rc = spawn(pool, i)) < 0) {
+	    pthread_mutex_lock(&pool->lock);
+	    if (rc == CGI_NOHELLO && !pool->ready) {
+		pool->classic = 1;
+		n = CGI_CLASSIC;
+	    }
+	    pthread_mutex_unlock(&pool->lock);
+	    break;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->ready = 1;
+	pthread_mutex_unlock(&pool->lock);
+	if (cgi_write_frame(pool->fds[i], cgiargs, strlen(cgiargs)) < 0) {
+	    reap(pool, i);
+	    continue;
+	}
+	if ((n = read_frame_by(pool->fds[i], out, maxlen,
+			       now_ms() + CGI_RUN_MS)) < 0) {
+	    reap(pool, i); /* hung, dead, or out of step with us */
+	    n = CGI_FAILED;
+	}
+	break;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->idle[pool->nidle++] = i;
+    pthread_mutex_unlock(&pool->lock);
+    V(&pool->avail);
+    return n;
+}
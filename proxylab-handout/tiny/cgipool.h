@@ -0,0 +1,31 @@
+#ifndef __CGIPOOL_H__
+#define __CGIPOOL_H__
+
+#include "csapp.h"
+
+#define CGI_WORKERS    8     /* persistent workers per CGI program */
+#define CGI_HELLO_MS   1000  /* how long a new worker has to say hello */
+#define CGI_RUN_MS     5000  /* how long a worker has to answer a request */
+
+/* cgipool_run failures */
+#define CGI_CLASSIC    -1    /* run the program the classic way instead */
+#define CGI_FAILED     -2    /* a worker failed it, or none could start */
+
+/* Pre-spawned workers for one CGI program */
+typedef struct cgi_pool {
+    char *filename;
+    int classic;               /* program doesn't speak cgiproto.h */
+    int ready;                 /* some worker of it has said hello */
+    int fds[CGI_WORKERS];      /* our end of each worker's socket, or -1 */
+    pid_t pids[CGI_WORKERS];
+    int idle[CGI_WORKERS];     /* stack of idle worker slots */
+    int nidle;
+    sem_t avail;               /* counts idle workers */
+    pthread_mutex_t lock;      /* protects idle/nidle, classic, ready */
+    struct cgi_pool *next;
+} cgi_pool;
+
+ssize_t cgipool_run(char *filename, char *cgiargs, char *out, size_t maxlen);
+void cgipool_closefds(void);
+
+#endif /* __CGIPOOL_H__ */
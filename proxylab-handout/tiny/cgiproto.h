@@ -0,0 +1,69 @@
+#ifndef __CGIPROTO_H__
+#define __CGIPROTO_H__
+
+/*
+ * cgiproto.h - framing used between tiny and its persistent CGI workers.
+ *
+ * A worker is started with CGI_WORKER_ENV set and a Unix socket on both
+ * stdin and stdout. It first sends a CGI_HELLO frame, then answers each
+ * request frame (the query string) with one response frame holding what
+ * a classic CGI program would print: headers, blank line, body. A frame
+ * is a 4-byte length in network order followed by that many bytes.
+ */
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#define CGI_WORKER_ENV "TINY_CGI_WORKER"
+#define CGI_HELLO      "TINYCGI1"
+#define CGI_MAXFRAME   65536
+
+/* Read or write exactly n bytes; returns n, 0 on EOF or -1 on error */
+static inline ssize_t cgi_io(int fd, void *buf, size_t n, int wr)
+{
+    size_t left = n;
+    ssize_t rc;
+    char *p = buf;
+
+    while (left > 0) {
+	rc = wr ? write(fd, p, left) : read(fd, p, left);
+	if (rc < 0 && errno == EINTR)
+	    continue;
+	if (rc <= 0)
+	    return rc;
+	left -= rc;
+	p += rc;
+    }
+    return n;
+}
+
+/* Send one frame; returns 0 on success, -1 on error */
+static inline int cgi_write_frame(int fd, const void *buf, uint32_t len)
+{
+    uint32_t nlen = htonl(len);
+
+    if (cgi_io(fd, &nlen, sizeof(nlen), 1) != sizeof(nlen) ||
+	cgi_io(fd, (void *)buf, len, 1) != (ssize_t)len)
+	return -1;
+    return 0;
+}
+
+/*
+ * Receive one frame of at most maxlen bytes into buf; returns its
+ * length, or -1 on EOF, error or an oversized frame
+ */
+static inline ssize_t cgi_read_frame(int fd, void *buf, uint32_t maxlen)
+{
+    uint32_t len;
+
+    if (cgi_io(fd, &len, sizeof(len), 0) != sizeof(len))
+	return -1;
+    if ((len = ntohl(len)) > maxlen)
+	return -1;
+    if (cgi_io(fd, buf, len, 0) != (ssize_t)len)
+	return -1;
+    return len;
+}
+
+#endif /* __CGIPROTO_H__ */
@@ -573,6 +573,31 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 /* $end rio_writen */
 
 
+/*
+ * rio_fill - Move the unread bytes to the front of the internal buffer
+ *    and read() more after them. Returns the number of bytes added,
+ *    0 on EOF and -1 on error.
+ */
+static ssize_t rio_fill(rio_t *rp)
+{
+    ssize_t rc;
+
+    if (rp->rio_bufptr != rp->rio_buf) {
+	memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+	rp->rio_bufptr = rp->rio_buf;
+    }
+    while (1) {
+	rc = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt,
+		  rp->rio_bufsize - rp->rio_cnt);
+	if (rc >= 0)
+	    break;
+	if (errno != EINTR) /* interrupted by sig handler return */
+	    return -1;
+    }
+    rp->rio_cnt += rc;
+    return rc;
+}
+
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
  *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
@@ -584,19 +609,12 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 /* $begin rio_read */
 static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 {
+    ssize_t rc;
     int cnt;
 
-    while (rp->rio_cnt <= 0) {  /* refill if buf is empty */
-	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
-			   sizeof(rp->rio_buf));
-	if (rp->rio_cnt < 0) {
-	    if (errno != EINTR) /* interrupted by sig handler return */
-		return -1;
-	}
-	else if (rp->rio_cnt == 0)  /* EOF */
-	    return 0;
-	else 
-	    rp->rio_bufptr = rp->rio_buf; /* reset buffer ptr */
+    if (rp->rio_cnt <= 0) {  /* refill if buf is empty */
+	if ((rc = rio_fill(rp)) <= 0)
+	    return rc;  /* EOF or error */
     }
 
     /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
@@ -610,6 +628,35 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
 }
 /* $end rio_read */
 
+/*
+ * rio_readv - Read straight into usrbuf, for requests of at least a
+ *    buffer's worth. The internal buffer, which must be empty, is the
+ *    second element of a readv(), so whatever else has arrived is
+ *    picked up by the same system call.
+ */
+static ssize_t rio_readv(rio_t *rp, char *usrbuf, size_t n)
+{
+    struct iovec iov[2];
+    ssize_t rc;
+
+    iov[0].iov_base = usrbuf;
+    iov[0].iov_len = n;
+    iov[1].iov_base = rp->rio_buf;
+    iov[1].iov_len = rp->rio_bufsize;
+    while (1) {
+	if ((rc = readv(rp->rio_fd, iov, 2)) >= 0)
+	    break;
+	if (errno != EINTR) /* interrupted by sig handler return */
+	    return -1;
+    }
+    if (rc > n) {  /* the rest went to the internal buffer */
+	rp->rio_bufptr = rp->rio_buf;
+	rp->rio_cnt = rc - n;
+	return n;
+    }
+    return rc;
+}
+
 /*
  * rio_readinitb - Associate a descriptor with a read buffer and reset buffer
  */
@@ -618,12 +665,29 @@ void rio_readinitb(rio_t *rp, int fd)
 {
     rp->rio_fd = fd;  
     rp->rio_cnt = 0;  
+    rp->rio_buf = rp->rio_ibuf;
+    rp->rio_bufsize = RIO_BUFSIZE;
     rp->rio_bufptr = rp->rio_buf;
 }
 /* $end rio_readinitb */
 
 /*
- * rio_readnb - Robustly read n bytes (buffered)
+ * rio_setbuf - Use the caller's size bytes at buf as the internal
+ *    buffer from now on, e.g. a small one for many idle connections or
+ *    a bigger one to grow past RIO_BUFSIZE. Unread bytes are carried
+ *    over, so it may be called at any time with size >= rio_cnt.
+ */
+void rio_setbuf(rio_t *rp, char *buf, size_t size)
+{
+    memmove(buf, rp->rio_bufptr, rp->rio_cnt);
+    rp->rio_buf = buf;
+    rp->rio_bufsize = size;
+    rp->rio_bufptr = buf;
+}
+
+/*
+ * rio_readnb - Robustly read n bytes (buffered; reads of at least a
+ *    buffer's worth go around the buffer once it is drained)
  */
 /* $begin rio_readnb */
 ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n) 
@@ -633,7 +697,11 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
     char *bufp = usrbuf;
     
     while (nleft > 0) {
-	if ((nread = rio_read(rp, bufp, nleft)) < 0) {
+	if (rp->rio_cnt <= 0 && nleft >= rp->rio_bufsize)
+	    nread = rio_readv(rp, bufp, nleft); /* bypass the buffer */
+	else
+	    nread = rio_read(rp, bufp, nleft);
+	if (nread < 0) {
 	    if (errno == EINTR) /* interrupted by sig handler return */
 		nread = 0;      /* call read() again */
 	    else
@@ -649,31 +717,217 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 /* $end rio_readnb */
 
 /* 
- * rio_readlineb - robustly read a text line (buffered)
+ * rio_readline - robustly read a text line (buffered). Whole runs of
+ *    the internal buffer are searched with memchr() and copied at once.
+ *    Returns the number of bytes stored (without the terminating NUL),
+ *    0 on EOF and -1 on error.
+ */
+ssize_t rio_readline(rio_t *rp, void *usrbuf, size_t maxlen) 
+{
+    size_t n = 0, cnt;
+    ssize_t rc;
+    char *bufp = usrbuf, *nl = NULL;
+
+    if (maxlen == 0)
+	return 0;
+    while (n + 1 < maxlen && nl == NULL) {
+	if (rp->rio_cnt <= 0) {
+	    if ((rc = rio_fill(rp)) < 0)
+		return -1;	  /* error */
+	    if (rc == 0)
+		break;		  /* EOF */
+	}
+	cnt = rp->rio_cnt;
+	if (cnt > maxlen - 1 - n)
+	    cnt = maxlen - 1 - n;
+	if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+	    cnt = nl - rp->rio_bufptr + 1;
+	memcpy(bufp + n, rp->rio_bufptr, cnt);
+	rp->rio_bufptr += cnt;
+	rp->rio_cnt -= cnt;
+	n += cnt;
+    }
+    bufp[n] = 0;
+    return n;
+}
+
+/*
+ * rio_getline - zero-copy rio_readline: point *linep at the next line,
+ *    '\n' included but not NUL-terminated, inside the internal buffer
+ *    and return its length. The line stays valid until the next read
+ *    from rp. A line that does not fit in the buffer comes back in
+ *    buffer-sized pieces without a '\n'. Returns 0 on EOF, -1 on error.
+ */
+ssize_t rio_getline(rio_t *rp, char **linep)
+{
+    size_t scanned = 0, n;
+    ssize_t rc;
+    char *nl;
+
+    while ((nl = memchr(rp->rio_bufptr + scanned, '\n',
+			rp->rio_cnt - scanned)) == NULL) {
+	scanned = rp->rio_cnt;
+	if (rp->rio_cnt == rp->rio_bufsize)
+	    break;		  /* line is longer than the buffer */
+	if ((rc = rio_fill(rp)) < 0)
+	    return -1;
+	if (rc == 0)
+	    break;		  /* EOF: hand out what is left */
+    }
+    n = nl ? nl - rp->rio_bufptr + 1 : rp->rio_cnt;
+    *linep = rp->rio_bufptr;
+    rp->rio_bufptr += n;
+    rp->rio_cnt -= n;
+    return n;
+}
+
+/* 
+ * rio_readlineb - robustly read a text line (buffered); the original
+ *    interface, now a wrapper for rio_readline()
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
-
-    for (n = 1; n < maxlen; n++) { 
-	if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n')
-		break;
-	} else if (rc == 0) {
-	    if (n == 1)
-		return 0; /* EOF, no data read */
-	    else
-		break;    /* EOF, some data was read */
+    return rio_readline(rp, usrbuf, maxlen);
+}
+/* $end rio_readlineb */
+
+/*
+ * rio_sendv - write all of iov[0..cnt-1]. Sockets get sendmsg(), so
+ *    that flags (MSG_MORE) apply; other descriptors get writev().
+ *    Returns 0, or -1 with errno set. iov is used up in the process.
+ */
+static int rio_sendv(rio_writer_t *wp, struct iovec *iov, int cnt, int flags)
+{
+    struct msghdr msg;
+    ssize_t n;
+
+    while (cnt > 0) {
+	if (iov->iov_len == 0) {
+	    iov++;
+	    cnt--;
+	    continue;
+	}
+	if (!wp->rio_notsock) {
+	    memset(&msg, 0, sizeof(msg));
+	    msg.msg_iov = iov;
+	    msg.msg_iovlen = cnt;
+	    n = sendmsg(wp->rio_fd, &msg, flags);
+	    if (n < 0 && errno == ENOTSOCK) {
+		wp->rio_notsock = 1;
+		continue;
+	    }
 	} else
-	    return -1;	  /* error */
+	    n = writev(wp->rio_fd, iov, cnt);
+	if (n < 0) {
+	    if (errno == EINTR)  /* interrupted by sig handler return */
+		continue;
+	    return -1;
+	}
+	/* Skip what was written */
+	while (cnt > 0 && n >= iov->iov_len) {
+	    n -= iov->iov_len;
+	    iov++;
+	    cnt--;
+	}
+	if (cnt > 0) {
+	    iov->iov_base = (char *)iov->iov_base + n;
+	    iov->iov_len -= n;
+	}
     }
-    *bufp = 0;
+    return 0;
+}
+
+/*
+ * rio_writerinit - Associate a descriptor with an output buffer
+ */
+void rio_writerinit(rio_writer_t *wp, int fd)
+{
+    wp->rio_fd = fd;
+    wp->rio_notsock = 0;
+    wp->rio_wcnt = 0;
+}
+
+/*
+ * rio_writeb - Append n bytes to the output (buffered). Bytes that do
+ *    not fit go out in one writev() together with what is buffered, so
+ *    a large body costs no extra copy. Returns n, or -1 on error.
+ */
+ssize_t rio_writeb(rio_writer_t *wp, void *usrbuf, size_t n)
+{
+    struct iovec iov[2];
+
+    if (n <= RIO_WBUFSIZE - wp->rio_wcnt) {
+	memcpy(wp->rio_wbuf + wp->rio_wcnt, usrbuf, n);
+	wp->rio_wcnt += n;
+	return n;
+    }
+    iov[0].iov_base = wp->rio_wbuf;
+    iov[0].iov_len = wp->rio_wcnt;
+    iov[1].iov_base = usrbuf;
+    iov[1].iov_len = n;
+    wp->rio_wcnt = 0;
+    if (rio_sendv(wp, iov, 2, 0) < 0)
+	return -1;
     return n;
 }
-/* $end rio_readlineb */
+
+/*
+ * rio_printfb - printf() to the output (buffered). Returns the length
+ *    written, or -1 on error (EMSGSIZE if it exceeds RIO_WBUFSIZE).
+ */
+ssize_t rio_printfb(rio_writer_t *wp, const char *fmt, ...)
+{
+    va_list ap;
+    size_t room;
+    int n;
+
+    va_start(ap, fmt);
+    room = RIO_WBUFSIZE - wp->rio_wcnt;
+    n = vsnprintf(wp->rio_wbuf + wp->rio_wcnt, room, fmt, ap);
+    va_end(ap);
+    if (n >= 0 && n >= room && wp->rio_wcnt > 0) {
+	/* Make room, then format again */
+	if (rio_flushb(wp, 1) < 0)
+	    return -1;
+	va_start(ap, fmt);
+	room = RIO_WBUFSIZE;
+	n = vsnprintf(wp->rio_wbuf, room, fmt, ap);
+	va_end(ap);
+    }
+    if (n < 0 || n >= room) {
+	if (n >= 0)
+	    errno = EMSGSIZE;
+	return -1;
+    }
+    wp->rio_wcnt += n;
+    return n;
+}
+
+/*
+ * rio_flushb - Write out everything buffered. If more is set the data
+ *    is sent with MSG_MORE, so the kernel may hold a partial segment
+ *    for what follows (e.g. a sendfile() body). Returns 0, or -1.
+ */
+ssize_t rio_flushb(rio_writer_t *wp, int more)
+{
+    struct iovec iov;
+
+    iov.iov_base = wp->rio_wbuf;
+    iov.iov_len = wp->rio_wcnt;
+    wp->rio_wcnt = 0;
+    return rio_sendv(wp, &iov, 1, more ? MSG_MORE : 0);
+}
+
+/*
+ * rio_cork - Set (on) or clear TCP_CORK on a socket, for responses
+ *    written partly by someone else, such as a CGI child. While corked
+ *    only full segments are sent; uncorking pushes out the rest.
+ */
+int rio_cork(int fd, int on)
+{
+    return setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
 
 /**********************************
  * Wrappers for robust I/O routines
@@ -716,6 +970,121 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
     return rc;
 } 
 
+/*************************************************************
+ * Non-exiting wrappers for server code paths. On error these
+ * return -1 (NULL for the allocators) and leave the cause in a
+ * thread-local last error instead of calling unix_error(), so
+ * that a failure costs one connection rather than the process.
+ *************************************************************/
+static __thread int last_errno;
+static __thread const char *last_op;
+
+/* set_error - record errno as the cause of op's failure */
+static int set_error(const char *op)
+{
+    last_errno = errno;
+    last_op = op;
+    return -1;
+}
+
+/* last_error - errno of this thread's last failed *_r call */
+int last_error(void)
+{
+    return last_errno;
+}
+
+/* last_error_op - name of this thread's last failed *_r call */
+const char *last_error_op(void)
+{
+    return last_op ? last_op : "none";
+}
+
+pid_t Fork_r(void) 
+{
+    pid_t pid;
+
+    if ((pid = fork()) < 0)
+	set_error("Fork_r");
+    return pid;
+}
+
+int Close_r(int fd) 
+{
+    if (close(fd) < 0)
+	return set_error("Close_r");
+    return 0;
+}
+
+void *Malloc_r(size_t size) 
+{
+    void *p;
+
+    if ((p = malloc(size)) == NULL)
+	set_error("Malloc_r");
+    return p;
+}
+
+void *Calloc_r(size_t nmemb, size_t size) 
+{
+    void *p;
+
+    if ((p = calloc(nmemb, size)) == NULL)
+	set_error("Calloc_r");
+    return p;
+}
+
+void *Realloc_r(void *ptr, size_t size) 
+{
+    void *p;
+
+    if ((p = realloc(ptr, size)) == NULL)
+	set_error("Realloc_r");
+    return p;
+}
+
+int Accept_r(int s, struct sockaddr *addr, socklen_t *addrlen) 
+{
+    int rc;
+
+    if ((rc = accept(s, addr, addrlen)) < 0)
+	return set_error("Accept_r");
+    return rc;
+}
+
+ssize_t Rio_readn_r(int fd, void *ptr, size_t nbytes) 
+{
+    ssize_t n;
+  
+    if ((n = rio_readn(fd, ptr, nbytes)) < 0)
+	return set_error("Rio_readn_r");
+    return n;
+}
+
+ssize_t Rio_writen_r(int fd, void *usrbuf, size_t n) 
+{
+    if (rio_writen(fd, usrbuf, n) != n)
+	return set_error("Rio_writen_r");
+    return n;
+}
+
+ssize_t Rio_readnb_r(rio_t *rp, void *usrbuf, size_t n) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_readnb(rp, usrbuf, n)) < 0)
+	return set_error("Rio_readnb_r");
+    return rc;
+}
+
+ssize_t Rio_readlineb_r(rio_t *rp, void *usrbuf, size_t maxlen) 
+{
+    ssize_t rc;
+
+    if ((rc = rio_readlineb(rp, usrbuf, maxlen)) < 0)
+	return set_error("Rio_readlineb_r");
+    return rc;
+}
+
 /******************************** 
  * Client/server helper functions
  ********************************/
@@ -0,0 +1,246 @@
+/*
+ * fcache.c - open-file and header cache for tiny's static content.
+ *
+ * Hot files are served without a stat() or open() per request: the
+ * descriptor and the rendered headers stay cached until inotify reports
+ * that the file was modified, had its attributes (mtime) changed, or
+ * was moved or deleted.
+ */
+#include <sys/inotify.h>
+#include "fcache.h"
+
+static fentry *table[FCACHE_BUCKETS];
+static int nentries = 0;
+static int inotify_fd = -1;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int hash(char *s)
+{
+    unsigned int h = 5381;
+
+    while (*s)
+	h = h * 33 + (unsigned char)*s++;
+    return h % FCACHE_BUCKETS;
+}
+
+/* Free an entry nobody references any more */
+static void release(fentry *fe)
+{
+    Close(fe->fd);
+    Free(fe->filename);
+    Free(fe->hdr);
+    Free(fe);
+}
+
+/*
+ * invalidate - drop every entry watched by wd. Entries still in use
+ * are freed by the last fcache_put().
+ */
+static void invalidate(int wd)
+{
+    fentry **pp, *fe;
+    int i;
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < FCACHE_BUCKETS; i++) {
+	pp = &table[i];
+	while ((fe = *pp) != NULL) {
+	    if (fe->wd != wd) {
+		pp = &fe->next;
+		continue;
+	    }
+	    *pp = fe->next;
+	    fe->wd = -1;
+	    nentries--;
+	    if (--fe->refcnt == 0)
+		release(fe);
+	}
+    }
+    pthread_mutex_unlock(&lock);
+    inotify_rm_watch(inotify_fd, wd);
+}
+
+/* watched - whether a cached entry uses wd; called with the lock held */
+static int watched(int wd)
+{
+    fentry *fe;
+    int i;
+
+    for (i = 0; i < FCACHE_BUCKETS; i++) {
+	for (fe = table[i]; fe != NULL; fe = fe->next) {
+	    if (fe->wd == wd)
+		return 1;
+	}
+    }
+    return 0;
+}
+
+/*
+ * unwatch - give up fe's watch before fe is cached, removing it unless a
+ * cached entry shares it (same inode); called with the lock held
+ */
+static void unwatch(fentry *fe)
+{
+    if (fe->wd >= 0 && !watched(fe->wd))
+	inotify_rm_watch(inotify_fd, fe->wd);
+    fe->wd = -1;
+}
+
+/* watcher - thread that turns inotify events into invalidations */
+static void *watcher(void *vargp)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *ev;
+    ssize_t n;
+    char *p;
+
+    Pthread_detach(pthread_self());
+    while ((n = read(inotify_fd, buf, sizeof(buf))) != 0) {
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	for (p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+	    ev = (struct inotify_event *)p;
+	    invalidate(ev->wd);
+	}
+    }
+    return NULL;
+}
+
+/*
+ * fcache_init - start watching for changes. Without inotify nothing is
+ * cached and every request opens the file itself.
+ */
+void fcache_init(void)
+{
+    pthread_t tid;
+
+    if ((inotify_fd = inotify_init()) < 0) {
+	fprintf(stderr, "inotify_init failed, static file cache disabled\n");
+	return;
+    }
+    Pthread_create(&tid, NULL, watcher, NULL);
+}
+
+/*
+ * fcache_get - return a referenced entry for filename, or NULL if it
+ * is not cached
+ */
+fentry *fcache_get(char *filename)
+{
+    fentry *fe;
+
+    pthread_mutex_lock(&lock);
+    for (fe = table[hash(filename)]; fe != NULL; fe = fe->next) {
+	if (!strcmp(fe->filename, filename)) {
+	    fe->refcnt++;
+	    break;
+	}
+    }
+    pthread_mutex_unlock(&lock);
+    return fe;
+}
+
+/*
+ * fcache_add - cache fd (open on filename, a file of type filetype),
+ * render its headers and return a referenced entry. The cache owns fd
+ * from here on. The size in the headers comes from an fstat() taken
+ * after the inotify watch is added, so a write that races with caching
+ * is either counted or invalidates the entry. A file replaced between
+ * the open and the watch is not cached. When the cache is full
+ * or unavailable, the entry is private to the caller and is closed by
+ * its fcache_put(). Returns NULL, with fd closed, if there is no memory
+ * for the entry or the file can't be stat'ed.
+ */
+fentry *fcache_add(char *filename, int fd, char *filetype)
+{
+    fentry *fe, *old;
+    unsigned int b = hash(filename);
+    struct stat sbuf, nbuf;
+    char hdr[MAXBUF];
+    int n;
+
+    if ((fe = Calloc_r(1, sizeof(fentry))) == NULL) {
+	close(fd);
+	return NULL;
+    }
+    if ((fe->filename = strdup(filename)) == NULL) {
+	Free(fe);
+	close(fd);
+	return NULL;
+    }
+    fe->fd = fd;
+    fe->wd = -1;
+    fe->refcnt = 1;
+
+    pthread_mutex_lock(&lock);
+    if (inotify_fd >= 0) {
+	for (old = table[b]; old != NULL; old = old->next) {
+	    if (!strcmp(old->filename, filename)) {
+		/* Another thread cached it first: use that one */
+		old->refcnt++;
+		pthread_mutex_unlock(&lock);
+		release(fe);
+		return old;
+	    }
+	}
+	if (nentries < FCACHE_MAX)
+	    fe->wd = inotify_add_watch(inotify_fd, filename,
+				       IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF |
+				       IN_DELETE_SELF);
+    }
+
+    /* Only now, with the watch in place, look at the file */
+    if (fstat(fd, &sbuf) < 0) {
+	unwatch(fe);
+	pthread_mutex_unlock(&lock);
+	release(fe);
+	return NULL;
+    }
+    /*
+     * The watch is on whatever filename names now. If the file was
+     * replaced since fd was opened, no event would ever reach this entry.
+     */
+    if (fe->wd >= 0 && (stat(filename, &nbuf) < 0 ||
+			nbuf.st_dev != sbuf.st_dev ||
+			nbuf.st_ino != sbuf.st_ino))
+	unwatch(fe);
+    if ((n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\n"
+		      "Server: Tiny Web Server\r\n"
+		      "Content-length: %lld\r\n"
+		      "Content-type: %s\r\n\r\n",
+		      (long long)sbuf.st_size, filetype)) >= (int)sizeof(hdr) ||
+	(fe->hdr = strdup(hdr)) == NULL) {
+	unwatch(fe);
+	pthread_mutex_unlock(&lock);
+	release(fe);
+	return NULL;
+    }
+    fe->size = sbuf.st_size;
+    fe->hdrlen = n;
+
+    if (fe->wd >= 0) {
+	fe->refcnt++;  /* the table's reference */
+	fe->next = table[b];
+	table[b] = fe;
+	nentries++;
+    }
+    pthread_mutex_unlock(&lock);
+    return fe;
+}
+
+/*
+ * fcache_put - drop a reference returned by fcache_get or fcache_add
+ */
+void fcache_put(fentry *fe)
+{
+    int last;
+
+    pthread_mutex_lock(&lock);
+    last = (--fe->refcnt == 0);
+    pthread_mutex_unlock(&lock);
+    if (last)
+	release(fe);
+}
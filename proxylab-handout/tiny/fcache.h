@@ -0,0 +1,30 @@
+#ifndef __FCACHE_H__
+#define __FCACHE_H__
+
+#include "csapp.h"
+
+#define FCACHE_BUCKETS 256
+#define FCACHE_MAX     1024  /* max cached files, i.e. open descriptors */
+
+/*
+ * An open static file plus its pre-rendered response headers. Entries
+ * are reference counted so a file that changes while it is being sent
+ * is only closed once the last request is done with it.
+ */
+typedef struct fentry {
+    char *filename;
+    int fd;                  /* O_RDONLY, shared; read with sendfile */
+    off_t size;
+    char *hdr;               /* complete status line and headers */
+    int hdrlen;
+    int wd;                  /* inotify watch, -1 if not cached */
+    int refcnt;
+    struct fentry *next;     /* hash chain */
+} fentry;
+
+void fcache_init(void);
+fentry *fcache_get(char *filename);
+fentry *fcache_add(char *filename, int fd, char *filetype);
+void fcache_put(fentry *fe);
+
+#endif /* __FCACHE_H__ */
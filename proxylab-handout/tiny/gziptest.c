@@ -0,0 +1,46 @@
+/*
+ * gziptest.c - check tiny's Accept-Encoding negotiation (make check)
+ */
+#include "assets.h"
+
+static struct {
+    char *value;
+    int gzip_ok;
+} cases[] = {
+    { "gzip\r\n",                  1 },
+    { " gzip, deflate\r\n",        1 },
+    { "deflate, gzip;q=1.0\r\n",   1 },
+    { "gzip;q=0\r\n",              0 },
+    { "gzip; q=0\r\n",             0 },
+    { "gzip ;q=0\r\n",             0 },
+    { "gzip;q = 0.000\r\n",        0 },
+    { "gzip;q=0.5\r\n",            1 },
+    { "gzip;q=0.01\r\n",           1 },
+    { "GZIP;Q=0.5\r\n",            1 },
+    { "x-gzip\r\n",                0 },
+    { "deflate\r\n",               0 },
+    { "identity, gzipx\r\n",       0 },
+    { "*\r\n",                     1 },
+    { "*;q=0\r\n",                 0 },
+    { "*, gzip;q=0\r\n",           0 },
+    { "gzip;q=0, *\r\n",           0 },
+    { "br;q=0, *;q=0.1\r\n",       1 },
+    { "\r\n",                      0 },
+    { NULL,                        0 }
+};
+
+int main(void)
+{
+    int i, failed = 0;
+
+    for (i = 0; cases[i].value; i++) {
+	if (accepts_gzip(cases[i].value) != cases[i].gzip_ok) {
+	    printf("FAIL: Accept-Encoding: %.*s should %s gzip\n",
+		   (int)strcspn(cases[i].value, "\r\n"), cases[i].value,
+		   cases[i].gzip_ok ? "accept" : "refuse");
+	    failed++;
+	}
+    }
+    printf("gziptest: %d of %d passed\n", i - failed, i);
+    return failed != 0;
+}
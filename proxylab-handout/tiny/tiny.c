@@ -1,66 +1,129 @@
 /* $begin tinymain */
 /*
- * tiny.c - A simple, iterative HTTP/1.0 Web server that uses the 
- *     GET method to serve static and dynamic content.
+ * tiny.c - A simple, prethreaded HTTP/1.0 Web server that uses the 
+ *     GET method to serve static and dynamic content. The main thread
+ *     accepts connections into a bounded buffer that a pool of worker
+ *     threads serves from.
  */
+#include <sys/sendfile.h>
 #include "csapp.h"
+#include "sbuf.h"
+#include "fcache.h"
+#include "cgipool.h"
+#include "cgiproto.h"
+#include "assets.h"
+
+#define NTHREADS  16    /* default number of worker threads */
+#define SBUFSIZE  1024  /* accepted connections waiting for a worker */
 
 void doit(int fd);
-void read_requesthdrs(rio_t *rp);
+void read_requesthdrs(rio_t *rp, char *etag, int *gzip_ok);
 int parse_uri(char *uri, char *filename, char *cgiargs);
-void serve_static(int fd, char *filename, int filesize);
-void get_filetype(char *filename, char *filetype);
+fentry *open_static(char *filename);
+void serve_static(int fd, fentry *fe);
+void serve_asset(int fd, asset *a, char *etag, int gzip_ok);
 void serve_dynamic(int fd, char *filename, char *cgiargs);
 void clienterror(int fd, char *cause, char *errnum, 
 		 char *shortmsg, char *longmsg);
+void *thread(void *vargp);
+
+sbuf_t sbuf; /* shared buffer of connected descriptors */
 
 int main(int argc, char **argv) 
 {
-    int listenfd, connfd, port, clientlen;
+    int i, listenfd, connfd, port, clientlen, nthreads = NTHREADS;
     struct sockaddr_in clientaddr;
+    pthread_t tid;
 
     /* Check command line args */
-    if (argc != 2) {
-	fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    if (argc != 2 && argc != 3) {
+	fprintf(stderr, "usage: %s <port> [threads]\n", argv[0]);
 	exit(1);
     }
     port = atoi(argv[1]);
+    if (argc == 3 && (nthreads = atoi(argv[2])) <= 0) {
+	fprintf(stderr, "threads must be positive\n");
+	exit(1);
+    }
+
+    /* A client that goes away mid-response must not kill the server */
+    Signal(SIGPIPE, SIG_IGN);
 
     listenfd = Open_listenfd(port);
+    assets_init("."); /* First: it blocks SIGHUP for all later threads */
+    fcache_init();
+    sbuf_init(&sbuf, SBUFSIZE);
+    for (i = 0; i < nthreads; i++)  /* Create worker threads */
+	Pthread_create(&tid, NULL, thread, NULL);
+
     while (1) {
 	clientlen = sizeof(clientaddr);
-	connfd = Accept(listenfd, (SA *)&clientaddr, (socklen_t *)&clientlen);
-	doit(connfd);
-	Close(connfd);
+	connfd = Accept_r(listenfd, (SA *)&clientaddr, (socklen_t *)&clientlen);
+	if (connfd < 0) { /* e.g. out of descriptors: keep serving */
+	    fprintf(stderr, "Accept error: %s\n", strerror(last_error()));
+	    continue;
+	}
+	sbuf_insert(&sbuf, connfd); /* Insert connfd in buffer */
     }
 }
 /* $end tinymain */
 
+/*
+ * thread - worker: serve connections from the shared buffer forever
+ */
+void *thread(void *vargp) 
+{
+    Pthread_detach(pthread_self());
+    while (1) {
+	int connfd = sbuf_remove(&sbuf); /* Remove connfd from buffer */
+	doit(connfd);
+	Close_r(connfd);
+    }
+}
+
 /*
  * doit - handle one HTTP request/response transaction
  */
 /* $begin doit */
 void doit(int fd) 
 {
-    int is_static;
+    int is_static, gzip_ok;
     struct stat sbuf;
     char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-    char filename[MAXLINE], cgiargs[MAXLINE];
+    char filename[MAXLINE], cgiargs[MAXLINE], etag[MAXLINE];
     rio_t rio;
+    fentry *fe;
+    asset_table *assets;
+    asset *a;
   
     /* Read request line and headers */
     Rio_readinitb(&rio, fd);
-    Rio_readlineb(&rio, buf, MAXLINE);
+    if (Rio_readlineb_r(&rio, buf, MAXLINE) <= 0)
+	return; /* client went away: drop just this connection */
     sscanf(buf, "%s %s %s", method, uri, version);
     if (strcasecmp(method, "GET")) { 
        clienterror(fd, method, "501", "Not Implemented",
                 "Tiny does not implement this method");
         return;
     }
-    read_requesthdrs(&rio);
+    read_requesthdrs(&rio, etag, &gzip_ok);
 
     /* Parse URI from GET request */
     is_static = parse_uri(uri, filename, cgiargs);
+    if (is_static) {
+	assets = assets_get();
+	if ((a = assets_find(assets, filename)) != NULL) {
+	    serve_asset(fd, a, etag, gzip_ok); /* From memory */
+	    assets_put(assets);
+	    return;
+	}
+	assets_put(assets);
+    }
+    if (is_static && (fe = fcache_get(filename)) != NULL) {
+	serve_static(fd, fe); /* Hot file: no stat, no open */
+	fcache_put(fe);
+	return;
+    }
     if (stat(filename, &sbuf) < 0) {
 	clienterror(fd, filename, "404", "Not found",
 		    "Tiny couldn't find this file");
@@ -73,7 +136,13 @@ void doit(int fd)
 			"Tiny couldn't read the file");
 	    return;
 	}
-	serve_static(fd, filename, sbuf.st_size);
+	if ((fe = open_static(filename)) == NULL) {
+	    clienterror(fd, filename, "403", "Forbidden",
+			"Tiny couldn't read the file");
+	    return;
+	}
+	serve_static(fd, fe);
+	fcache_put(fe);
     }
     else { /* Serve dynamic content */
 	if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) {
@@ -87,18 +156,32 @@ void doit(int fd)
 /* $end doit */
 
 /*
- * read_requesthdrs - read and parse HTTP request headers
+ * read_requesthdrs - read and parse HTTP request headers, keeping the
+ *     If-None-Match value (or "") and whether gzip is acceptable
  */
 /* $begin read_requesthdrs */
-void read_requesthdrs(rio_t *rp) 
+void read_requesthdrs(rio_t *rp, char *etag, int *gzip_ok) 
 {
-    char buf[MAXLINE];
+    char buf[MAXLINE], *line;
+    ssize_t n;
 
-    Rio_readlineb(rp, buf, MAXLINE);
-    printf("%s", buf);
-    while(strcmp(buf, "\r\n")) {
-	Rio_readlineb(rp, buf, MAXLINE);
-	printf("%s", buf);
+    etag[0] = '\0';
+    *gzip_ok = 0;
+    /* Headers are looked at in place; only the ones we keep are copied */
+    while ((n = rio_getline(rp, &line)) > 0) {
+	printf("%.*s", (int)n, line);
+	if ((n == 2 && line[0] == '\r') || (n == 1 && line[0] == '\n'))
+	    break;
+	if (n > 16 && n < MAXLINE &&
+	    (!strncasecmp(line, "If-None-Match:", 14) ||
+	     !strncasecmp(line, "Accept-Encoding:", 16))) {
+	    memcpy(buf, line, n);
+	    buf[n] = '\0';
+	    if (buf[0] == 'I' || buf[0] == 'i')
+		sscanf(buf + 14, " %[^\r\n]", etag);
+	    else
+		*gzip_ok = accepts_gzip(buf + 16);
+	}
     }
     return;
 }
@@ -137,67 +220,118 @@ int parse_uri(char *uri, char *filename, char *cgiargs)
 /* $end parse_uri */
 
 /*
- * serve_static - copy a file back to the client 
+ * open_static - open filename and have its response headers rendered
+ *     once, caching both for later requests. Returns NULL if it can't
+ *     be read.
  */
-/* $begin serve_static */
-void serve_static(int fd, char *filename, int filesize) 
+fentry *open_static(char *filename) 
 {
     int srcfd;
-    char *srcp, filetype[MAXLINE], buf[MAXBUF];
- 
-    /* Send response headers to client */
+    char filetype[MAXLINE];
+
+    if ((srcfd = open(filename, O_RDONLY, 0)) < 0)
+	return NULL;
     get_filetype(filename, filetype);
-    sprintf(buf, "HTTP/1.0 200 OK\r\n");
-    sprintf(buf, "%sServer: Tiny Web Server\r\n", buf);
-    sprintf(buf, "%sContent-length: %d\r\n", buf, filesize);
-    sprintf(buf, "%sContent-type: %s\r\n\r\n", buf, filetype);
-    Rio_writen(fd, buf, strlen(buf));
-
-    /* Send response body to client */
-    srcfd = Open(filename, O_RDONLY, 0);
-    srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);
-    Close(srcfd);
-    Rio_writen(fd, srcp, filesize);
-    Munmap(srcp, filesize);
+    return fcache_add(filename, srcfd, filetype);
 }
 
 /*
- * get_filetype - derive file type from file name
+ * serve_static - send the cached headers, then the file with sendfile()
+ *     so the body never passes through user space
  */
-void get_filetype(char *filename, char *filetype) 
+/* $begin serve_static */
+void serve_static(int fd, fentry *fe) 
 {
-    if (strstr(filename, ".html"))
-	strcpy(filetype, "text/html");
-    else if (strstr(filename, ".gif"))
-	strcpy(filetype, "image/gif");
-    else if (strstr(filename, ".jpg"))
-	strcpy(filetype, "image/jpeg");
-    else
-	strcpy(filetype, "text/plain");
-}  
+    rio_writer_t w;
+    off_t offset = 0;
+    ssize_t n;
+
+    /* MSG_MORE lets the headers share a segment with the body */
+    rio_writerinit(&w, fd);
+    if (rio_writeb(&w, fe->hdr, fe->hdrlen) < 0 || rio_flushb(&w, 1) < 0)
+	return;
+    while (offset < fe->size) {
+	if ((n = sendfile(fd, fe->fd, &offset, fe->size - offset)) <= 0) {
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    return; /* client went away, or the file shrank */
+	}
+    }
+}
 /* $end serve_static */
 
+/*
+ * serve_asset - answer from the in-memory asset store: 304 if the
+ *     client's ETag matches, else the gzip or plain body. Headers and
+ *     body leave in a single write.
+ */
+/* $begin serve_asset */
+void serve_asset(int fd, asset *a, char *etag, int gzip_ok) 
+{
+    rio_writer_t w;
+
+    rio_writerinit(&w, fd);
+    if (etag[0] && (!strcmp(etag, "*") || strstr(etag, a->etag))) {
+	rio_writeb(&w, a->hdr304, strlen(a->hdr304));
+    } else if (gzip_ok && a->gzbody) {
+	rio_writeb(&w, a->gzhdr, strlen(a->gzhdr));
+	if (rio_writeb(&w, a->gzbody, a->gzsize) < 0)
+	    return;
+    } else {
+	rio_writeb(&w, a->hdr, strlen(a->hdr));
+	if (rio_writeb(&w, a->body, a->size) < 0)
+	    return;
+    }
+    rio_flushb(&w, 0);
+}
+/* $end serve_asset */
+
 /*
  * serve_dynamic - run a CGI program on behalf of the client
  */
 /* $begin serve_dynamic */
 void serve_dynamic(int fd, char *filename, char *cgiargs) 
 {
-    char buf[MAXLINE], *emptylist[] = { NULL };
+    char buf[MAXLINE + CGI_MAXFRAME], *emptylist[] = { NULL };
+    pid_t pid;
+    ssize_t n;
+    int len;
 
     /* Return first part of HTTP response */
-    sprintf(buf, "HTTP/1.0 200 OK\r\n");
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Server: Tiny Web Server\r\n");
-    Rio_writen(fd, buf, strlen(buf));
-  
-    if (Fork() == 0) { /* child */
+    len = sprintf(buf, "HTTP/1.0 200 OK\r\n"
+		  "Server: Tiny Web Server\r\n");
+
+    /* Persistent worker: the whole response goes out in one write */
+    if ((n = cgipool_run(filename, cgiargs, buf + len, CGI_MAXFRAME)) >= 0) {
+	Rio_writen_r(fd, buf, len + n);
+	return;
+    }
+    if (n == CGI_FAILED) { /* it may have run: don't run it again */
+	clienterror(fd, filename, "500", "Internal Server Error",
+		    "The CGI program failed");
+	return;
+    }
+
+    /*
+     * Classic CGI program: fork and exec it for this request. The socket
+     * is corked meanwhile, so our status line and the child's output
+     * go out in full segments rather than one per write.
+     */
+    rio_cork(fd, 1);
+    if (Rio_writen_r(fd, buf, len) < 0) {
+	rio_cork(fd, 0);
+	return;
+    }
+    if ((pid = Fork_r()) == 0) { /* child */
 	/* Real server would set all CGI vars here */
 	setenv("QUERY_STRING", cgiargs, 1); 
 	Dup2(fd, STDOUT_FILENO);         /* Redirect stdout to client */
+	cgipool_closefds();              /* Keep none of the server's fds */
 	Execve(filename, emptylist, environ); /* Run CGI program */
     }
-    Wait(NULL); /* Parent waits for and reaps child */
+    if (pid > 0)
+	Waitpid(pid, NULL, 0); /* Reap our own child, not another thread's */
+    rio_cork(fd, 0); /* push out the last partial segment */
 }
 /* $end serve_dynamic */
 
@@ -208,7 +342,8 @@ void serve_dynamic(int fd, char *filename, char *cgiargs)
 void clienterror(int fd, char *cause, char *errnum, 
 		 char *shortmsg, char *longmsg) 
 {
-    char buf[MAXLINE], body[MAXBUF];
+    char body[MAXBUF];
+    rio_writer_t w;
 
     /* Build the HTTP response body */
     sprintf(body, "<html><title>Tiny Error</title>");
@@ -217,13 +352,12 @@ void clienterror(int fd, char *cause, char *errnum,
     sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
     sprintf(body, "%s<hr><em>The Tiny Web server</em>\r\n", body);
 
-    /* Print the HTTP response */
-    sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Content-type: text/html\r\n");
-    Rio_writen(fd, buf, strlen(buf));
-    sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-    Rio_writen(fd, buf, strlen(buf));
-    Rio_writen(fd, body, strlen(body));
+    /* Print the HTTP response, in one write */
+    rio_writerinit(&w, fd);
+    rio_printfb(&w, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
+    rio_printfb(&w, "Content-type: text/html\r\n");
+    rio_printfb(&w, "Content-length: %d\r\n\r\n", (int)strlen(body));
+    rio_writeb(&w, body, strlen(body));
+    rio_flushb(&w, 0); /* an error just means the client is gone */
 }
 /* $end clienterror */